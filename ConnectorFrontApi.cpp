@@ -3,6 +3,8 @@
 #include "ConnectorFrontApi.h"
 #include "MediaSoupInterface.h"
 #include "MediaSoupMailbox.h"
+#include "MediaSoupGallery.h"
+#include "MediaSoupAudioMixer.h"
 
 void ConnectorFrontApi::func_load_device(void *data, calldata_t *cd)
 {
@@ -16,6 +18,7 @@ void ConnectorFrontApi::func_stop_receiver(void *data, calldata_t *cd)
 	std::string input = calldata_string(cd, "input");
 	blog(LOG_WARNING, "func_stop_receiver %s", input.c_str());
 	MediaSoupInterface::instance().getTransceiver()->StopReceiveTransport();
+	MediaSoupInterface::instance().forgetAllConsumers();
 
 	auto sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
 	sourceInfo->m_consumer_audio.clear();
@@ -34,6 +37,7 @@ void ConnectorFrontApi::func_stop_consumer(void *data, calldata_t *cd)
 	std::string input = calldata_string(cd, "input");
 	blog(LOG_WARNING, "func_stop_consumer %s", input.c_str());
 	std::string destroyedId = MediaSoupInterface::instance().getTransceiver()->StopConsumerByProducerId(input);
+	MediaSoupInterface::instance().forgetConsumer(destroyedId);
 	auto sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
 
 	if (destroyedId == sourceInfo->m_consumer_audio)
@@ -49,6 +53,100 @@ void ConnectorFrontApi::func_stop_producer(void *data, calldata_t *cd)
 	MediaSoupInterface::instance().getTransceiver()->StopProducerById(input);
 }
 
+void ConnectorFrontApi::func_update_producer_encodings(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_update_producer_encodings %s", input.c_str());
+	ConnectorFrontApiHelper::updateProducerEncodings(input, cd);
+}
+
+void ConnectorFrontApi::func_replace_producer_track(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_replace_producer_track %s", input.c_str());
+	ConnectorFrontApiHelper::replaceProducerTrack(input, cd);
+}
+
+void ConnectorFrontApi::func_consumer_state(void *data, calldata_t *cd)
+{
+	auto sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
+	ConnectorFrontApiHelper::consumerState(*sourceInfo, cd);
+}
+
+void ConnectorFrontApi::func_set_decode_budget(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_set_decode_budget %s", input.c_str());
+	ConnectorFrontApiHelper::setDecodeBudget(input, cd);
+}
+
+void ConnectorFrontApi::func_get_layer_requests(void *data, calldata_t *cd)
+{
+	json output = MediaSoupInterface::instance().getTransceiver()->GetLayerRequests();
+	calldata_set_string(cd, "output", output.dump().c_str());
+}
+
+void ConnectorFrontApi::func_attach_consumer(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_attach_consumer %s", input.c_str());
+	ConnectorFrontApiHelper::attachConsumer(*static_cast<MediaSoupInterface::ObsSourceInfo *>(data), input, cd);
+}
+
+void ConnectorFrontApi::func_set_sync_delay(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_set_sync_delay %s", input.c_str());
+	ConnectorFrontApiHelper::setSyncDelay(input, cd);
+}
+
+void ConnectorFrontApi::func_set_jitter_buffer(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_set_jitter_buffer %s", input.c_str());
+	ConnectorFrontApiHelper::setJitterBuffer(input, cd);
+}
+
+void ConnectorFrontApi::func_get_jitter_buffer(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	ConnectorFrontApiHelper::getJitterBuffer(input, cd);
+}
+
+// Polled, so no logging
+void ConnectorFrontApi::func_get_audio_levels(void *data, calldata_t *cd)
+{
+	json output = MediaSoupInterface::instance().getTransceiver()->GetAudioLevels();
+	calldata_set_string(cd, "output", output.dump().c_str());
+}
+
+void ConnectorFrontApi::func_get_consumer_stats(void *data, calldata_t *cd)
+{
+	json output = MediaSoupInterface::instance().getTransceiver()->GetConsumerStats();
+	calldata_set_string(cd, "output", output.dump().c_str());
+}
+
+// The factory times only show up once their warm up is done
+void ConnectorFrontApi::func_get_load_timings(void *data, calldata_t *cd)
+{
+	json output = MediaSoupInterface::instance().getTransceiver()->GetLoadTimings();
+	calldata_set_string(cd, "output", output.dump().c_str());
+}
+
+void ConnectorFrontApi::func_start_consumer_recording(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_start_consumer_recording %s", input.c_str());
+	ConnectorFrontApiHelper::startConsumerRecording(input, cd);
+}
+
+void ConnectorFrontApi::func_stop_consumer_recording(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_stop_consumer_recording %s", input.c_str());
+	ConnectorFrontApiHelper::stopConsumerRecording(input, cd);
+}
+
 void ConnectorFrontApi::func_connect_result(void *data, calldata_t *cd)
 {
 	std::string input = calldata_string(cd, "input");
@@ -135,4 +233,43 @@ void ConnectorFrontApi::func_audio_consumer_response(void *data, calldata_t *cd)
 	ConnectorFrontApiHelper::createConsumer(*static_cast<MediaSoupInterface::ObsSourceInfo *>(data), input, "audio", cd);
 }
 
+// Gallery, data is the MediaSoupGallery
+
+void ConnectorFrontApi::func_gallery_video_consumer_response(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_gallery_video_consumer_response %s", input.c_str());
+	static_cast<MediaSoupGallery *>(data)->createConsumer(input, cd);
+}
+
+void ConnectorFrontApi::func_gallery_set_producers(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_gallery_set_producers %s", input.c_str());
+
+	std::vector<std::string> producerIds;
+
+	try {
+		json jsonInput = json::parse(input);
+
+		for (auto &itr : jsonInput["producers"])
+			producerIds.push_back(itr.get<std::string>());
+	} catch (...) {
+		blog(LOG_ERROR, "%s func_gallery_set_producers bad json", obs_module_description());
+		return;
+	}
+
+	json output = static_cast<MediaSoupGallery *>(data)->setProducers(producerIds);
+	calldata_set_string(cd, "output", output.dump().c_str());
+}
+
+// Mixer, data is the source's std::shared_ptr<MediaSoupAudioMixer>
+
+void ConnectorFrontApi::func_mixer_set_consumers(void *data, calldata_t *cd)
+{
+	std::string input = calldata_string(cd, "input");
+	blog(LOG_WARNING, "func_mixer_set_consumers %s", input.c_str());
+	ConnectorFrontApiHelper::setMixerConsumers(*static_cast<std::shared_ptr<MediaSoupAudioMixer> *>(data), input, cd);
+}
+
 #endif
@@ -6,6 +6,8 @@
 #include <iostream>
 #include <third_party/libyuv/include/libyuv.h>
 
+class MediaSoupAudioMixer;
+
 struct ConnectorFrontApi {
 	static void func_load_device(void *data, calldata_t *cd);
 	static void func_create_send_transport(void *data, calldata_t *cd);
@@ -20,6 +22,23 @@ struct ConnectorFrontApi {
 	static void func_stop_sender(void *data, calldata_t *cd);
 	static void func_stop_consumer(void *data, calldata_t *cd);
 	static void func_stop_producer(void *data, calldata_t *cd);
+	static void func_update_producer_encodings(void *data, calldata_t *cd);
+	static void func_replace_producer_track(void *data, calldata_t *cd);
+	static void func_consumer_state(void *data, calldata_t *cd);
+	static void func_set_decode_budget(void *data, calldata_t *cd);
+	static void func_get_layer_requests(void *data, calldata_t *cd);
+	static void func_attach_consumer(void *data, calldata_t *cd);
+	static void func_set_sync_delay(void *data, calldata_t *cd);
+	static void func_set_jitter_buffer(void *data, calldata_t *cd);
+	static void func_get_jitter_buffer(void *data, calldata_t *cd);
+	static void func_get_audio_levels(void *data, calldata_t *cd);
+	static void func_get_consumer_stats(void *data, calldata_t *cd);
+	static void func_get_load_timings(void *data, calldata_t *cd);
+	static void func_start_consumer_recording(void *data, calldata_t *cd);
+	static void func_stop_consumer_recording(void *data, calldata_t *cd);
+	static void func_gallery_video_consumer_response(void *data, calldata_t *cd);
+	static void func_gallery_set_producers(void *data, calldata_t *cd);
+	static void func_mixer_set_consumers(void *data, calldata_t *cd);
 };
 
 struct ConnectorFrontApiHelper {
@@ -30,6 +49,17 @@ struct ConnectorFrontApiHelper {
 	static bool createConsumer(MediaSoupInterface::ObsSourceInfo &obsSourceInfo, const std::string &params, const std::string &kind, calldata_t *cd);
 	static bool createSender(const std::string &params, calldata_t *cd);
 	static bool createReceiver(const std::string &params, calldata_t *cd);
+	static bool updateProducerEncodings(const std::string &params, calldata_t *cd);
+	static bool replaceProducerTrack(const std::string &params, calldata_t *cd);
+	static bool consumerState(MediaSoupInterface::ObsSourceInfo &obsSourceInfo, calldata_t *cd);
+	static bool setDecodeBudget(const std::string &params, calldata_t *cd);
+	static bool setSyncDelay(const std::string &params, calldata_t *cd);
+	static bool setJitterBuffer(const std::string &params, calldata_t *cd);
+	static bool getJitterBuffer(const std::string &params, calldata_t *cd);
+	static bool startConsumerRecording(const std::string &params, calldata_t *cd);
+	static bool stopConsumerRecording(const std::string &params, calldata_t *cd);
+	static bool attachConsumer(MediaSoupInterface::ObsSourceInfo &obsSourceInfo, const std::string &params, calldata_t *cd);
+	static bool setMixerConsumers(std::shared_ptr<MediaSoupAudioMixer> mixer, const std::string &params, calldata_t *cd);
 
 	static bool onConnect(const std::string &clientId, const std::string &transportId, const json &dtlsParameters);
 	static bool onProduce(const std::string &clientId, const std::string &transportId, const std::string &kind, const json &rtpParameters,
@@ -3,6 +3,8 @@
 #include "ConnectorFrontApi.h"
 #include "MediaSoupInterface.h"
 #include "MediaSoupMailbox.h"
+#include "MediaSoupAudioMixer.h"
+#include "MediaSoupFrameHub.h"
 
 bool ConnectorFrontApiHelper::createReceiver(const std::string &params, calldata_t *cd)
 {
@@ -97,10 +99,12 @@ bool ConnectorFrontApiHelper::createConsumer(MediaSoupInterface::ObsSourceInfo &
 
 	json params_parsed;
 	std::string inputId;
+	std::string producerId;
 
 	try {
 		params_parsed = json::parse(params);
 		inputId = params_parsed["id"].get<std::string>();
+		producerId = params_parsed.value("producerId", "");
 	} catch (...) {
 		blog(LOG_WARNING, "%s createConsumer audio but already ready", obs_module_description());
 		return false;
@@ -111,22 +115,43 @@ bool ConnectorFrontApiHelper::createConsumer(MediaSoupInterface::ObsSourceInfo &
 		return false;
 	}
 
-	if (kind == "video")
+	// Another source already receives this producer, share it. The front end should close the server side consumer it just made
+	std::string existingId;
+
+	if (MediaSoupInterface::instance().attachToConsumer(obsSourceInfo, producerId, kind, existingId)) {
+		json output;
+		output["attached"] = true;
+		output["id"] = existingId;
+		calldata_set_string(cd, "output", output.dump().c_str());
+		return true;
+	}
+
+	if (kind == "video") {
 		obsSourceInfo.m_consumer_video = inputId;
-	else if (kind == "audio")
+
+		// Textures are ready before the consumer exists, the first frame is just an upload
+		MediaSoupInterface::prepareConsumerView(obsSourceInfo);
+	} else if (kind == "audio") {
 		obsSourceInfo.m_consumer_audio = inputId;
+	}
 
-	auto func = [](const json params_parsed, const std::string kind, obs_source_t *source) {
+	auto func = [](const json params_parsed, const std::string kind, MediaSoupInterface::ObsSourceInfo *sourceInfo) {
 		try {
 			auto id = params_parsed["id"].get<std::string>();
 			auto producerId = params_parsed["producerId"].get<std::string>();
 			auto rtpParam = params_parsed["rtpParameters"].get<json>();
+			obs_source_t *source = sourceInfo->m_obs_source;
+			bool created = false;
 
 			if (kind == "audio")
-				MediaSoupInterface::instance().getTransceiver()->CreateAudioConsumer(id, producerId, &rtpParam, source);
+				created = MediaSoupInterface::instance().getTransceiver()->CreateAudioConsumer(id, producerId, &rtpParam, source);
 
 			if (kind == "video")
-				MediaSoupInterface::instance().getTransceiver()->CreateVideoConsumer(id, producerId, &rtpParam);
+				created = MediaSoupInterface::instance().getTransceiver()->CreateVideoConsumer(
+					id, producerId, &rtpParam, MediaSoupInterface::isAsyncVideoSource(source) ? source : nullptr);
+
+			if (created)
+				MediaSoupInterface::instance().registerConsumer(*sourceInfo, producerId, kind, id);
 		} catch (...) {
 			blog(LOG_ERROR, "%s createVideoConsumer exception", obs_module_description());
 		}
@@ -137,7 +162,7 @@ bool ConnectorFrontApiHelper::createConsumer(MediaSoupInterface::ObsSourceInfo &
 	// Connect handshake on the receive transport is not needed more than once on the transport
 	if (MediaSoupInterface::instance().getTransceiver()->ConsumerReadyAtLeastOne()) {
 		// In which case, just do on this thread
-		func(params_parsed, kind, obsSourceInfo.m_obs_source);
+		func(params_parsed, kind, &obsSourceInfo);
 		return MediaSoupInterface::instance().getTransceiver()->PopLastError().empty();
 	} else {
 		if (MediaSoupInterface::instance().isThreadInProgress()) {
@@ -146,7 +171,7 @@ bool ConnectorFrontApiHelper::createConsumer(MediaSoupInterface::ObsSourceInfo &
 		}
 
 		MediaSoupInterface::instance().setThreadIsProgress(true);
-		std::unique_ptr<std::thread> thr = std::make_unique<std::thread>(func, params_parsed, kind, obsSourceInfo.m_obs_source);
+		std::unique_ptr<std::thread> thr = std::make_unique<std::thread>(func, params_parsed, kind, &obsSourceInfo);
 
 		int64_t timeExpire = getWaitTimeoutDurationSeconds() +
 				     std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
@@ -224,6 +249,8 @@ bool ConnectorFrontApiHelper::createProducerTrack(const std::string &kind, calld
 				json ecodings;
 				json codecOptions;
 				json codec;
+				std::string passthroughEncoder;
+				std::string contentHint;
 
 				try {
 					ecodings = jsonInput["encodings"];
@@ -237,10 +264,20 @@ bool ConnectorFrontApiHelper::createProducerTrack(const std::string &kind, calld
 					codec = jsonInput["codec"];
 				} catch (...) {
 				}
+				try {
+					// Name of an h264 obs encoder (ie, the streaming one) whose output is sent instead of encoding again
+					passthroughEncoder = jsonInput.value("passthroughEncoder", "");
+				} catch (...) {
+				}
+				try {
+					// "motion", "detail" or "text"
+					contentHint = jsonInput.value("contentHint", "");
+				} catch (...) {
+				}
 
 				MediaSoupInterface::instance().getTransceiver()->CreateVideoProducerTrack(producerId, ecodings.empty() ? nullptr : &ecodings,
 													  codecOptions.empty() ? nullptr : &codecOptions,
-													  codec.empty() ? nullptr : &codec);
+													  codec.empty() ? nullptr : &codec, passthroughEncoder, contentHint);
 			} else {
 				blog(LOG_ERROR, "%s createProducerTrack unexpected kind %s", obs_module_description(), kind.c_str());
 			}
@@ -319,6 +356,411 @@ bool ConnectorFrontApiHelper::createVideoProducerTrack(calldata_t *cd, const std
 	return createProducerTrack("video", cd, input);
 }
 
+bool ConnectorFrontApiHelper::updateProducerEncodings(const std::string &params, calldata_t *cd)
+{
+	blog(LOG_DEBUG, "updateProducerEncodings start");
+
+	json jsonInput;
+	std::string producerId;
+
+	try {
+		jsonInput = json::parse(params);
+		producerId = jsonInput["id"].get<std::string>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s updateProducerEncodings bad json", obs_module_description());
+		return false;
+	}
+
+	json encodings;
+
+	if (!MediaSoupInterface::instance().getTransceiver()->UpdateProducerEncodings(producerId, jsonInput, encodings)) {
+		blog(LOG_ERROR, "%s updateProducerEncodings failed, error '%s'", obs_module_description(),
+		     MediaSoupInterface::instance().getTransceiver()->PopLastError().c_str());
+		return false;
+	}
+
+	json output;
+	output["encodings"] = encodings;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+struct ProducerFilterSearch {
+	std::string producerId;
+	obs_source_t *filter{nullptr};
+	obs_source_t *parent{nullptr};
+};
+
+static void findProducerFilterOnSource(obs_source_t *parent, obs_source_t *filter, void *param)
+{
+	auto search = static_cast<ProducerFilterSearch *>(param);
+
+	if (search->filter != nullptr)
+		return;
+
+	std::string id = obs_source_get_id(filter);
+
+	if (id != "mediasoupconnector_vfilter" && id != "mediasoupconnector_vsfilter")
+		return;
+
+	auto settings = obs_source_get_settings(filter);
+
+	if (search->producerId == obs_data_get_string(settings, "producerId")) {
+		search->filter = filter;
+		search->parent = parent;
+	}
+
+	obs_data_release(settings);
+}
+
+static bool findProducerFilter(void *param, obs_source_t *source)
+{
+	obs_source_enum_filters(source, findProducerFilterOnSource, param);
+	return static_cast<ProducerFilterSearch *>(param)->filter == nullptr;
+}
+
+// Moves the filter feeding a producer onto another source, the producer's mailbox and track stay as they are
+// Async sources need the async filter, anything else the sync one, so a filter of the wrong kind is recreated
+static bool moveProducerFilter(const std::string &producerId, obs_source_t *target)
+{
+	ProducerFilterSearch search;
+	search.producerId = producerId;
+	obs_enum_sources(findProducerFilter, &search);
+
+	if (search.filter == nullptr)
+		obs_enum_scenes(findProducerFilter, &search);
+
+	const bool targetAsync = (obs_source_get_output_flags(target) & OBS_SOURCE_ASYNC) != 0;
+	const char *filterId = targetAsync ? "mediasoupconnector_vfilter" : "mediasoupconnector_vsfilter";
+
+	if (search.parent == target && strcmp(obs_source_get_id(search.filter), filterId) == 0)
+		return true;
+
+	obs_data_t *settings = nullptr;
+	std::string name = "mediasoup-" + producerId;
+
+	if (search.filter != nullptr) {
+		settings = obs_source_get_settings(search.filter);
+		name = obs_source_get_name(search.filter);
+	} else {
+		settings = obs_data_create();
+		obs_data_set_string(settings, "producerId", producerId.c_str());
+	}
+
+	obs_source_t *filter = nullptr;
+
+	if (search.filter != nullptr && strcmp(obs_source_get_id(search.filter), filterId) == 0)
+		filter = obs_source_get_ref(search.filter);
+	else
+		filter = obs_source_create(filterId, name.c_str(), settings, nullptr);
+
+	obs_data_release(settings);
+
+	if (filter == nullptr)
+		return false;
+
+	// The filter's remove callback drops the old parent from the frame hub
+	if (search.filter != nullptr)
+		obs_source_filter_remove(search.parent, search.filter);
+
+	obs_source_filter_add(target, filter);
+	MediaSoupFrameHub::instance().subscribe(target, producerId);
+	obs_source_release(filter);
+	return true;
+}
+
+bool ConnectorFrontApiHelper::replaceProducerTrack(const std::string &params, calldata_t *cd)
+{
+	blog(LOG_DEBUG, "replaceProducerTrack start");
+
+	std::string producerId;
+	std::string sourceName;
+	std::string contentHint;
+
+	try {
+		auto jsonInput = json::parse(params);
+		producerId = jsonInput["id"].get<std::string>();
+		sourceName = jsonInput["source"].get<std::string>();
+		contentHint = jsonInput.value("contentHint", "");
+	} catch (...) {
+		blog(LOG_WARNING, "%s replaceProducerTrack bad json", obs_module_description());
+		return false;
+	}
+
+	// Checked before the filter moves, a bad producer or source name leaves everything as it was
+	if (!MediaSoupInterface::instance().getTransceiver()->CanReplaceProducerTrack(producerId)) {
+		blog(LOG_ERROR, "%s replaceProducerTrack failed, error '%s'", obs_module_description(),
+		     MediaSoupInterface::instance().getTransceiver()->PopLastError().c_str());
+		return false;
+	}
+
+	obs_source_t *target = obs_get_source_by_name(sourceName.c_str());
+
+	if (target == nullptr) {
+		blog(LOG_ERROR, "%s replaceProducerTrack source '%s' not found", obs_module_description(), sourceName.c_str());
+		return false;
+	}
+
+	bool moved = moveProducerFilter(producerId, target);
+	obs_source_release(target);
+
+	if (!moved) {
+		blog(LOG_ERROR, "%s replaceProducerTrack could not move the filter to '%s'", obs_module_description(), sourceName.c_str());
+		return false;
+	}
+
+	// The track only changes for a new content hint, the old one reads the same mailbox so the move stands even if this fails
+	if (!MediaSoupInterface::instance().getTransceiver()->ReplaceProducerTrack(producerId, contentHint)) {
+		blog(LOG_ERROR, "%s replaceProducerTrack failed, error '%s'", obs_module_description(),
+		     MediaSoupInterface::instance().getTransceiver()->PopLastError().c_str());
+		return false;
+	}
+
+	json output;
+	output["id"] = producerId;
+	output["source"] = sourceName;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// The current state on demand, changes are also sent as the consumer_paused signal so the front end needn't poll
+bool ConnectorFrontApiHelper::consumerState(MediaSoupInterface::ObsSourceInfo &obsSourceInfo, calldata_t *cd)
+{
+	json consumers = json::array();
+
+	if (!obsSourceInfo.m_consumer_video.empty())
+		consumers.push_back({{"id", obsSourceInfo.m_consumer_video},
+				     {"kind", "video"},
+				     {"paused", MediaSoupInterface::instance().getTransceiver()->ConsumerPaused(obsSourceInfo.m_consumer_video)}});
+
+	if (!obsSourceInfo.m_consumer_audio.empty())
+		consumers.push_back({{"id", obsSourceInfo.m_consumer_audio},
+				     {"kind", "audio"},
+				     {"paused", MediaSoupInterface::instance().getTransceiver()->ConsumerPaused(obsSourceInfo.m_consumer_audio)}});
+
+	json output;
+	output["hidden"] = obsSourceInfo.m_hidden;
+	output["consumers"] = consumers;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// Lets the front end skip the server side consume entirely when another source already receives the producer
+bool ConnectorFrontApiHelper::attachConsumer(MediaSoupInterface::ObsSourceInfo &obsSourceInfo, const std::string &params, calldata_t *cd)
+{
+	std::string producerId;
+	std::string kind;
+
+	try {
+		auto jsonInput = json::parse(params);
+		producerId = jsonInput["producerId"].get<std::string>();
+		kind = jsonInput["kind"].get<std::string>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s attachConsumer bad json", obs_module_description());
+		return false;
+	}
+
+	std::string consumerId;
+	json output;
+	output["attached"] = MediaSoupInterface::instance().attachToConsumer(obsSourceInfo, producerId, kind, consumerId);
+	output["id"] = consumerId;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+bool ConnectorFrontApiHelper::setDecodeBudget(const std::string &params, calldata_t *cd)
+{
+	int64_t pixelsPerSecond = 0;
+
+	try {
+		auto jsonInput = json::parse(params);
+		pixelsPerSecond = jsonInput["pixelsPerSecond"].get<int64_t>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s setDecodeBudget bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupInterface::instance().getTransceiver()->SetDecodeBudget(pixelsPerSecond);
+
+	json output = MediaSoupInterface::instance().getTransceiver()->GetLayerRequests();
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"consumers":[{"id":"...","gain":1.0}]}, consumers left out go back to their own sources
+bool ConnectorFrontApiHelper::setMixerConsumers(std::shared_ptr<MediaSoupAudioMixer> mixer, const std::string &params, calldata_t *cd)
+{
+	std::map<std::string, float> requested;
+
+	try {
+		auto jsonInput = json::parse(params);
+
+		for (auto &itr : jsonInput["consumers"])
+			requested[itr["id"].get<std::string>()] = itr.value("gain", 1.f);
+	} catch (...) {
+		blog(LOG_WARNING, "%s setMixerConsumers bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupTransceiver *transceiver = MediaSoupInterface::instance().getTransceiver();
+
+	for (auto &id : mixer->getInputIds()) {
+		if (requested.find(id) == requested.end())
+			transceiver->SetConsumerAudioMixer(id, nullptr);
+	}
+
+	std::map<std::string, float> mixed;
+	json missing = json::array();
+
+	// Registered with the mixer first so nothing pushed in between is dropped
+	mixer->setInputs(requested);
+
+	for (auto &itr : requested) {
+		if (transceiver->SetConsumerAudioMixer(itr.first, mixer))
+			mixed[itr.first] = itr.second;
+		else
+			missing.push_back(itr.first);
+	}
+
+	mixer->setInputs(mixed);
+
+	json output;
+	output["mixed"] = json::array();
+
+	for (auto &itr : mixed)
+		output["mixed"].push_back(itr.first);
+
+	output["missing"] = missing;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"delayMs":20}, applies to every consumer's audio and video alike
+bool ConnectorFrontApiHelper::setSyncDelay(const std::string &params, calldata_t *cd)
+{
+	int delayMs = 0;
+
+	try {
+		auto jsonInput = json::parse(params);
+		delayMs = jsonInput["delayMs"].get<int>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s setSyncDelay bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupSyncEngine::instance().setPresentationDelayMs(delayMs);
+
+	json output;
+	output["delayMs"] = MediaSoupSyncEngine::instance().getPresentationDelayMs();
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"id":"...","preset":"minimal|smooth|default|custom","delayMs":0,"targetMs":150}, without an id it's the default for every consumer
+bool ConnectorFrontApiHelper::setJitterBuffer(const std::string &params, calldata_t *cd)
+{
+	std::string id;
+	std::string preset;
+	int delayMs = 0;
+	int targetMs = 0;
+
+	try {
+		auto jsonInput = json::parse(params);
+		id = jsonInput.value("id", "");
+		preset = jsonInput["preset"].get<std::string>();
+		delayMs = jsonInput.value("delayMs", 0);
+		targetMs = jsonInput.value("targetMs", 0);
+	} catch (...) {
+		blog(LOG_WARNING, "%s setJitterBuffer bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupTransceiver *transceiver = MediaSoupInterface::instance().getTransceiver();
+	const bool applied = id.empty() ? transceiver->SetDefaultJitterBuffer(preset, delayMs, targetMs)
+					: transceiver->SetConsumerJitterBuffer(id, preset, delayMs, targetMs);
+
+	if (!applied) {
+		blog(LOG_WARNING, "%s setJitterBuffer %s", obs_module_description(), transceiver->PopLastError().c_str());
+		return false;
+	}
+
+	json output = transceiver->GetJitterBufferState(id);
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"id":"..."} or {} for every consumer
+bool ConnectorFrontApiHelper::getJitterBuffer(const std::string &params, calldata_t *cd)
+{
+	std::string id;
+
+	try {
+		if (!params.empty())
+			id = json::parse(params).value("id", "");
+	} catch (...) {
+		blog(LOG_WARNING, "%s getJitterBuffer bad json", obs_module_description());
+		return false;
+	}
+
+	json output = MediaSoupInterface::instance().getTransceiver()->GetJitterBufferState(id);
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"id":"...","path":"..."}, the path's extension is up to the caller, video is written as ivf and audio as ogg opus
+bool ConnectorFrontApiHelper::startConsumerRecording(const std::string &params, calldata_t *cd)
+{
+	std::string id;
+	std::string path;
+
+	try {
+		auto jsonInput = json::parse(params);
+		id = jsonInput["id"].get<std::string>();
+		path = jsonInput["path"].get<std::string>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s startConsumerRecording bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupTransceiver *transceiver = MediaSoupInterface::instance().getTransceiver();
+
+	if (!transceiver->StartConsumerRecording(id, path)) {
+		blog(LOG_WARNING, "%s startConsumerRecording %s", obs_module_description(), transceiver->PopLastError().c_str());
+		return false;
+	}
+
+	json output;
+	output["id"] = id;
+	output["path"] = path;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
+// {"id":"..."}, returns what was written
+bool ConnectorFrontApiHelper::stopConsumerRecording(const std::string &params, calldata_t *cd)
+{
+	std::string id;
+
+	try {
+		id = json::parse(params)["id"].get<std::string>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s stopConsumerRecording bad json", obs_module_description());
+		return false;
+	}
+
+	MediaSoupTransceiver *transceiver = MediaSoupInterface::instance().getTransceiver();
+	json output;
+
+	if (!transceiver->StopConsumerRecording(id, output)) {
+		blog(LOG_WARNING, "%s stopConsumerRecording %s", obs_module_description(), transceiver->PopLastError().c_str());
+		return false;
+	}
+
+	output["id"] = id;
+	calldata_set_string(cd, "output", output.dump().c_str());
+	return true;
+}
+
 bool ConnectorFrontApiHelper::onConnect(const std::string &clientId, const std::string &transportId, const json &dtlsParameters)
 {
 	json data;
@@ -379,16 +821,25 @@ void ConnectorFrontApiHelper::createInterfaceObject(const std::string &routerRtp
 	json rotuerRtpCapabilities;
 	json deviceRtpCapabilities;
 	json deviceSctpCapabilities;
+	bool sharedFactory = false;
 
 	try {
 		rotuerRtpCapabilities = json::parse(routerRtpCapabilities_Raw);
+
+		// Either the capabilities as is, or {"routerRtpCapabilities":{...},"sharedFactory":true}
+		if (rotuerRtpCapabilities.find("routerRtpCapabilities") != rotuerRtpCapabilities.end()) {
+			sharedFactory = rotuerRtpCapabilities.value("sharedFactory", false);
+			json inner = rotuerRtpCapabilities["routerRtpCapabilities"];
+			rotuerRtpCapabilities = inner;
+		}
 	} catch (...) {
 		blog(LOG_ERROR, "msoup_create json error parsing routerRtpCapabilities_Raw %s", routerRtpCapabilities_Raw.c_str());
 		return;
 	}
 
 	// lib - Create device
-	if (!MediaSoupInterface::instance().getTransceiver()->LoadDevice(rotuerRtpCapabilities, deviceRtpCapabilities, deviceSctpCapabilities)) {
+	if (!MediaSoupInterface::instance().getTransceiver()->LoadDevice(rotuerRtpCapabilities, deviceRtpCapabilities, deviceSctpCapabilities,
+									  sharedFactory)) {
 		blog(LOG_ERROR, "msoup_create LoadDevice failed error = '%s'", MediaSoupInterface::instance().getTransceiver()->PopLastError().c_str());
 		return;
 	}
@@ -398,6 +849,8 @@ void ConnectorFrontApiHelper::createInterfaceObject(const std::string &routerRtp
 	output["deviceSctpCapabilities"] = deviceSctpCapabilities;
 	output["version"] = mediasoupclient::Version();
 	output["clientId"] = MediaSoupInterface::instance().getTransceiver()->GetId();
+	output["sharedFactory"] = MediaSoupInterface::instance().getTransceiver()->SharedFactory();
+	output["timings"] = MediaSoupInterface::instance().getTransceiver()->GetLoadTimings();
 	calldata_set_string(cd, "output", output.dump().c_str());
 }
 
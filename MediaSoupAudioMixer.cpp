@@ -0,0 +1,231 @@
+#ifndef _DEBUG
+
+#include "MediaSoupAudioMixer.h"
+
+#include <util/platform.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MSOUP_MIXER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MSOUP_MIXER_NEON
+#endif
+
+/**
+* MediaSoupAudioMixer
+*/
+
+MediaSoupAudioMixer::MediaSoupAudioMixer(obs_source_t *source) : m_source(source)
+{
+	m_accumulator.resize(kFramesPer10Ms * kChannels);
+	m_output.resize(kFramesPer10Ms * kChannels);
+}
+
+// Inputs not in the map are dropped, existing ones keep what they have queued
+void MediaSoupAudioMixer::setInputs(const std::map<std::string, float> &gains)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	for (auto itr = m_inputs.begin(); itr != m_inputs.end();) {
+		if (gains.find(itr->first) == gains.end())
+			itr = m_inputs.erase(itr);
+		else
+			++itr;
+	}
+
+	for (auto &itr : gains)
+		m_inputs[itr.first].m_gain = itr.second;
+}
+
+void MediaSoupAudioMixer::removeInput(const std::string &consumerId)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_inputs.erase(consumerId);
+
+	// Whoever was waiting on it can go now
+	mixReady();
+}
+
+std::vector<std::string> MediaSoupAudioMixer::getInputIds()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	std::vector<std::string> output;
+
+	for (auto &itr : m_inputs)
+		output.push_back(itr.first);
+
+	return output;
+}
+
+void MediaSoupAudioMixer::shutdown()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_source = nullptr;
+	m_inputs.clear();
+}
+
+void MediaSoupAudioMixer::push(const std::string &consumerId, const int16_t *data, const int sampleRate, const size_t channels, const size_t frames)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	auto itr = m_inputs.find(consumerId);
+
+	if (itr == m_inputs.end() || channels == 0)
+		return;
+
+	// The consumer playout device pulls at this rate, so webrtc already delivers it
+	if (sampleRate != kSampleRate) {
+		if (!m_warnedSampleRate)
+			blog(LOG_WARNING, "MediaSoupAudioMixer::push - Dropping %d Hz audio from %s, expected %d Hz", sampleRate, consumerId.c_str(), kSampleRate);
+
+		m_warnedSampleRate = true;
+		return;
+	}
+
+	Input &input = itr->second;
+	input.m_starved = false;
+
+	// Mono is duplicated, anything past the first two channels is left out
+	const size_t offset = input.m_samples.size();
+	input.m_samples.resize(offset + frames * kChannels);
+	int16_t *dst = input.m_samples.data() + offset;
+
+	for (size_t i = 0; i < frames; ++i) {
+		dst[i * 2] = data[i * channels];
+		dst[i * 2 + 1] = data[i * channels + (channels > 1 ? 1 : 0)];
+	}
+
+	const size_t maxSamples = kMaxQueued * kFramesPer10Ms * kChannels;
+
+	if (input.m_samples.size() > maxSamples)
+		input.m_samples.erase(input.m_samples.begin(), input.m_samples.begin() + (input.m_samples.size() - maxSamples));
+
+	mixReady();
+}
+
+void MediaSoupAudioMixer::mixReady()
+{
+	const size_t frameSamples = kFramesPer10Ms * kChannels;
+
+	while (m_source != nullptr) {
+		bool any = false;
+		bool allLive = true;
+		bool backlog = false;
+
+		for (auto &itr : m_inputs) {
+			const size_t queued = itr.second.m_samples.size();
+			any |= queued >= frameSamples;
+			backlog |= queued >= kMaxBacklog * frameSamples;
+
+			if (queued < frameSamples && !itr.second.m_starved)
+				allLive = false;
+		}
+
+		if (!any)
+			return;
+
+		if (allLive)
+			mixOne(false);
+		else if (backlog)
+			mixOne(true);
+		else
+			return;
+	}
+}
+
+void MediaSoupAudioMixer::mixOne(const bool forced)
+{
+	const size_t frameSamples = kFramesPer10Ms * kChannels;
+	std::fill(m_accumulator.begin(), m_accumulator.end(), 0.f);
+
+	for (auto &itr : m_inputs) {
+		Input &input = itr.second;
+
+		if (input.m_samples.size() < frameSamples) {
+			if (forced)
+				input.m_starved = true;
+
+			continue;
+		}
+
+		accumulate(m_accumulator.data(), input.m_samples.data(), input.m_gain, frameSamples);
+		input.m_samples.erase(input.m_samples.begin(), input.m_samples.begin() + frameSamples);
+	}
+
+	saturate(m_accumulator.data(), m_output.data(), frameSamples);
+
+	obs_source_audio sdata = {};
+	sdata.data[0] = reinterpret_cast<uint8_t *>(m_output.data());
+	sdata.frames = uint32_t(kFramesPer10Ms);
+	sdata.speakers = SPEAKERS_STEREO;
+	sdata.samples_per_sec = kSampleRate;
+	sdata.format = AUDIO_FORMAT_16BIT;
+	sdata.timestamp = MediaSoupSyncEngine::instance().getAudioPresentationTime(m_clock, kFramesPer10Ms, kSampleRate);
+	obs_source_output_audio(m_source, &sdata);
+}
+
+// acc += src * gain
+void MediaSoupAudioMixer::accumulate(float *acc, const int16_t *src, const float gain, const size_t count)
+{
+	size_t i = 0;
+
+#if defined(MSOUP_MIXER_SSE2)
+	const __m128 vgain = _mm_set1_ps(gain);
+
+	for (; i + 8 <= count; i += 8) {
+		const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+		// Sign extend by unpacking into the high half and shifting back down
+		const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+		const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(lo, vgain)));
+		_mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(hi, vgain)));
+	}
+#elif defined(MSOUP_MIXER_NEON)
+	for (; i + 8 <= count; i += 8) {
+		const int16x8_t samples = vld1q_s16(src + i);
+		const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples)));
+		const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples)));
+
+		vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), lo, gain));
+		vst1q_f32(acc + i + 4, vmlaq_n_f32(vld1q_f32(acc + i + 4), hi, gain));
+	}
+#endif
+
+	for (; i < count; ++i)
+		acc[i] += float(src[i]) * gain;
+}
+
+// Clamped to int16, a loud room clips instead of wrapping around
+void MediaSoupAudioMixer::saturate(const float *acc, int16_t *dst, const size_t count)
+{
+	size_t i = 0;
+
+#if defined(MSOUP_MIXER_SSE2)
+	// cvttps truncates like the scalar tail and returns INT_MIN on overflow, so clamp before converting and let packs do the rest
+	const __m128 vmin = _mm_set1_ps(-32768.f);
+	const __m128 vmax = _mm_set1_ps(32767.f);
+
+	for (; i + 8 <= count; i += 8) {
+		const __m128i lo = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), vmin), vmax));
+		const __m128i hi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i + 4), vmin), vmax));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(lo, hi));
+	}
+#elif defined(MSOUP_MIXER_NEON)
+	// Both the conversion and the narrowing saturate
+	for (; i + 8 <= count; i += 8) {
+		const int16x4_t lo = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(acc + i)));
+		const int16x4_t hi = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(acc + i + 4)));
+		vst1q_s16(dst + i, vcombine_s16(lo, hi));
+	}
+#endif
+
+	for (; i < count; ++i)
+		dst[i] = int16_t(std::min(32767.f, std::max(-32768.f, acc[i])));
+}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "MediaSoupSyncEngine.h"
+
+#include <obs-module.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+* MediaSoupAudioMixer
+*/
+
+// Mixes a set of audio consumers in the plugin and outputs them as one obs source
+// Webrtc delivers every consumer's 10 ms from the same playout pull, so a frame is mixed as soon as each live input has one queued
+class MediaSoupAudioMixer {
+public:
+	MediaSoupAudioMixer(obs_source_t *source);
+
+	void setInputs(const std::map<std::string, float> &gains);
+	void removeInput(const std::string &consumerId);
+	std::vector<std::string> getInputIds();
+
+	// From the consumers' audio sinks
+	void push(const std::string &consumerId, const int16_t *data, const int sampleRate, const size_t channels, const size_t frames);
+
+	// The owning source is going away, sinks may still hold a reference for a moment
+	void shutdown();
+
+	static const int kSampleRate = 48000;
+	static const size_t kChannels = 2;
+	static const size_t kFramesPer10Ms = kSampleRate / 100;
+
+	// Kernels, picked at compile time
+	static void accumulate(float *acc, const int16_t *src, const float gain, const size_t count);
+	static void saturate(const float *acc, int16_t *dst, const size_t count);
+
+private:
+	struct Input {
+		// Interleaved stereo
+		std::vector<int16_t> m_samples;
+		float m_gain = 1.f;
+
+		// Stopped delivering, doesn't hold back the others until it does again
+		bool m_starved{false};
+	};
+
+	void mixReady();
+	void mixOne(const bool forced);
+
+	// Past this many queued 10 ms frames on any input the missing ones are mixed in as silence, past the cap the oldest are dropped
+	static const size_t kMaxBacklog = 3;
+	static const size_t kMaxQueued = 5;
+
+	std::mutex m_mtx;
+	std::map<std::string, Input> m_inputs;
+	std::vector<float> m_accumulator;
+	std::vector<int16_t> m_output;
+	obs_source_t *m_source{nullptr};
+	bool m_warnedSampleRate{false};
+	MediaSoupSyncEngine::AudioClock m_clock;
+};
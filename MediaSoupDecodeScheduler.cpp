@@ -0,0 +1,265 @@
+#ifndef _DEBUG
+
+#include "MediaSoupDecodeScheduler.h"
+
+#include <algorithm>
+#include <climits>
+
+/**
+* MediaSoupDecodeScheduler
+*/
+
+void MediaSoupDecodeScheduler::addConsumer(const std::string &id, const json &rtpParameters)
+{
+	Entry entry;
+
+	try {
+		if (rtpParameters.contains("encodings") && !rtpParameters["encodings"].empty())
+			parseScalabilityMode(rtpParameters["encodings"][0].value("scalabilityMode", ""), entry.m_spatialLayers, entry.m_temporalLayers);
+	} catch (...) {
+	}
+
+	// Start from the top, same as the server does until told otherwise
+	entry.m_assignment.spatialLayer = entry.m_spatialLayers - 1;
+	entry.m_assignment.temporalLayer = entry.m_temporalLayers - 1;
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_entries[id] = entry;
+}
+
+void MediaSoupDecodeScheduler::removeConsumer(const std::string &id)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_entries.erase(id);
+}
+
+void MediaSoupDecodeScheduler::clear()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_entries.clear();
+}
+
+// 0 means unlimited, layers are then only capped by what the canvas shows
+void MediaSoupDecodeScheduler::setBudget(const int64_t pixelsPerSecond)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_budget = std::max(int64_t(0), pixelsPerSecond);
+}
+
+void MediaSoupDecodeScheduler::updateDisplay(const std::string &id, const int displayPixels, const int canvasFramerate, const bool visible)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	auto itr = m_entries.find(id);
+
+	if (itr == m_entries.end())
+		return;
+
+	itr->second.m_displayPixels = displayPixels;
+	itr->second.m_canvasFramerate = canvasFramerate;
+	itr->second.m_visible = visible;
+}
+
+void MediaSoupDecodeScheduler::updateDecoded(const std::string &id, const uint64_t decodedPixels, const int largestFramePixels, const uint64_t nowNs)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	auto itr = m_entries.find(id);
+
+	if (itr == m_entries.end())
+		return;
+
+	Entry &entry = itr->second;
+
+	if (entry.m_lastSampleNs != 0 && nowNs > entry.m_lastSampleNs)
+		entry.m_decodedPixelsPerSecond = int64_t(decodedPixels * 1000000000ull / (nowNs - entry.m_lastSampleNs));
+
+	entry.m_lastSampleNs = nowNs;
+
+	if (largestFramePixels <= 0)
+		return;
+
+	// Only trust the size while on the top layer, a layer switch takes a keyframe to land
+	// Otherwise scale it back up for a first guess, each spatial layer is assumed to be half the size of the next
+	const int layersBelowTop = entry.m_spatialLayers - 1 - entry.m_assignment.spatialLayer;
+
+	if (layersBelowTop == 0)
+		entry.m_topLayerPixels = largestFramePixels;
+	else if (entry.m_topLayerPixels == 0)
+		entry.m_topLayerPixels = largestFramePixels << (2 * layersBelowTop);
+}
+
+std::vector<std::string> MediaSoupDecodeScheduler::schedule()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	std::vector<std::pair<std::string, Entry *>> ranked;
+	std::map<std::string, Assignment> previous;
+	int64_t remaining = m_budget > 0 ? m_budget : INT64_MAX;
+
+	// Everyone starts on the bottom layer, hidden consumers are paused and cost nothing
+	for (auto &itr : m_entries) {
+		previous[itr.first] = itr.second.m_assignment;
+		itr.second.m_assignment.spatialLayer = 0;
+		itr.second.m_assignment.temporalLayer = 0;
+
+		if (!itr.second.m_visible)
+			continue;
+
+		remaining -= cost(itr.second, 0, 0);
+		ranked.push_back({itr.first, &itr.second});
+	}
+
+	// Biggest on the canvas first, 0 means not measured yet so treat it as full screen
+	std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, Entry *> &a, const std::pair<std::string, Entry *> &b) {
+		const int64_t left = a.second->m_displayPixels > 0 ? a.second->m_displayPixels : INT_MAX;
+		const int64_t right = b.second->m_displayPixels > 0 ? b.second->m_displayPixels : INT_MAX;
+		return left > right;
+	});
+
+	for (auto &itr : ranked) {
+		Entry &entry = *itr.second;
+		Assignment &assignment = entry.m_assignment;
+
+		// No point decoding more than is drawn
+		int neededSpatial = entry.m_spatialLayers - 1;
+		int neededTemporal = entry.m_temporalLayers - 1;
+
+		if (entry.m_displayPixels > 0) {
+			neededSpatial = 0;
+
+			while (neededSpatial < entry.m_spatialLayers - 1 && layerPixels(entry, neededSpatial) < entry.m_displayPixels)
+				++neededSpatial;
+		}
+
+		if (entry.m_canvasFramerate > 0) {
+			neededTemporal = 0;
+
+			while (neededTemporal < entry.m_temporalLayers - 1 && layerFramerate(entry, neededTemporal) < entry.m_canvasFramerate)
+				++neededTemporal;
+		}
+
+		while (assignment.spatialLayer < neededSpatial) {
+			const int64_t extra = cost(entry, assignment.spatialLayer + 1, assignment.temporalLayer) -
+					      cost(entry, assignment.spatialLayer, assignment.temporalLayer);
+
+			if (extra > remaining)
+				break;
+
+			remaining -= extra;
+			++assignment.spatialLayer;
+		}
+
+		while (assignment.temporalLayer < neededTemporal) {
+			const int64_t extra = cost(entry, assignment.spatialLayer, assignment.temporalLayer + 1) -
+					      cost(entry, assignment.spatialLayer, assignment.temporalLayer);
+
+			if (extra > remaining)
+				break;
+
+			remaining -= extra;
+			++assignment.temporalLayer;
+		}
+	}
+
+	std::vector<std::string> changed;
+	m_scheduledPixelsPerSecond = 0;
+
+	for (auto &itr : m_entries) {
+		Entry &entry = itr.second;
+		Assignment &assignment = entry.m_assignment;
+
+		// Holds to the budget even before the front end switches the server over
+		assignment.maxPixelCount = layerPixels(entry, assignment.spatialLayer);
+		assignment.maxFramerate = layerFramerate(entry, assignment.temporalLayer);
+
+		if (entry.m_displayPixels > 0)
+			assignment.maxPixelCount = std::min(assignment.maxPixelCount, entry.m_displayPixels);
+
+		if (entry.m_canvasFramerate > 0)
+			assignment.maxFramerate = std::min(assignment.maxFramerate, entry.m_canvasFramerate);
+
+		if (entry.m_visible)
+			m_scheduledPixelsPerSecond += cost(entry, assignment.spatialLayer, assignment.temporalLayer);
+
+		const Assignment &before = previous[itr.first];
+
+		if (before.spatialLayer != assignment.spatialLayer || before.temporalLayer != assignment.temporalLayer ||
+		    before.maxPixelCount != assignment.maxPixelCount || before.maxFramerate != assignment.maxFramerate)
+			changed.push_back(itr.first);
+	}
+
+	return changed;
+}
+
+bool MediaSoupDecodeScheduler::getAssignment(const std::string &id, Assignment &output)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	auto itr = m_entries.find(id);
+
+	if (itr == m_entries.end())
+		return false;
+
+	output = itr->second.m_assignment;
+	return true;
+}
+
+// The front end forwards these to the server with consumer.setPreferredLayers()
+json MediaSoupDecodeScheduler::getLayerRequests()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	json consumers = json::array();
+	int64_t decoded = 0;
+
+	for (auto &itr : m_entries) {
+		decoded += itr.second.m_decodedPixelsPerSecond;
+		consumers.push_back({{"id", itr.first},
+				     {"spatialLayer", itr.second.m_assignment.spatialLayer},
+				     {"temporalLayer", itr.second.m_assignment.temporalLayer},
+				     {"visible", itr.second.m_visible}});
+	}
+
+	json output;
+	output["budget"] = m_budget;
+	output["scheduledPixelsPerSecond"] = m_scheduledPixelsPerSecond;
+	output["decodedPixelsPerSecond"] = decoded;
+	output["consumers"] = consumers;
+	return output;
+}
+
+// "L3T3", "L3T3_KEY", "S3T3", "L1T3"... anything else is a single layer
+void MediaSoupDecodeScheduler::parseScalabilityMode(const std::string &mode, int &spatialLayers, int &temporalLayers)
+{
+	spatialLayers = 1;
+	temporalLayers = 1;
+
+	if (mode.size() < 4 || (mode[0] != 'L' && mode[0] != 'S') || mode[2] != 'T')
+		return;
+
+	if (mode[1] >= '1' && mode[1] <= '9')
+		spatialLayers = mode[1] - '0';
+
+	if (mode[3] >= '1' && mode[3] <= '9')
+		temporalLayers = mode[3] - '0';
+}
+
+int MediaSoupDecodeScheduler::layerPixels(const Entry &entry, const int spatialLayer)
+{
+	const int top = entry.m_topLayerPixels > 0 ? entry.m_topLayerPixels : getDefaultTopLayerPixels();
+	return top >> (2 * (entry.m_spatialLayers - 1 - spatialLayer));
+}
+
+// Each temporal layer doubles the rate of the one below it
+int MediaSoupDecodeScheduler::layerFramerate(const Entry &entry, const int temporalLayer)
+{
+	return std::max(1, getDefaultStreamFramerate() >> (entry.m_temporalLayers - 1 - temporalLayer));
+}
+
+int64_t MediaSoupDecodeScheduler::cost(const Entry &entry, const int spatialLayer, const int temporalLayer)
+{
+	return int64_t(layerPixels(entry, spatialLayer)) * layerFramerate(entry, temporalLayer);
+}
+
+#endif
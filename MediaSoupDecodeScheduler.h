@@ -0,0 +1,72 @@
+#pragma once
+
+#include <json.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+* MediaSoupDecodeScheduler
+*/
+
+// Keeps the total decoded pixels per second across all video consumers under a budget
+// Visible consumers are ranked by on-canvas size, the largest get their layers first and small or hidden ones drop first
+class MediaSoupDecodeScheduler {
+public:
+	struct Assignment {
+		int spatialLayer = 0;
+		int temporalLayer = 0;
+
+		// Local VideoSinkWants, 0 means no limit
+		int maxPixelCount = 0;
+		int maxFramerate = 0;
+	};
+
+public:
+	void addConsumer(const std::string &id, const json &rtpParameters);
+	void removeConsumer(const std::string &id);
+	void clear();
+
+	void setBudget(const int64_t pixelsPerSecond);
+	void updateDisplay(const std::string &id, const int displayPixels, const int canvasFramerate, const bool visible);
+	void updateDecoded(const std::string &id, const uint64_t decodedPixels, const int largestFramePixels, const uint64_t nowNs);
+
+	// Recomputes every assignment, returns the ids whose assignment changed
+	std::vector<std::string> schedule();
+
+	bool getAssignment(const std::string &id, Assignment &output);
+	json getLayerRequests();
+
+	static void parseScalabilityMode(const std::string &mode, int &spatialLayers, int &temporalLayers);
+
+private:
+	struct Entry {
+		int m_spatialLayers = 1;
+		int m_temporalLayers = 1;
+		int m_displayPixels = 0;
+		int m_canvasFramerate = 0;
+		int m_topLayerPixels = 0;
+		bool m_visible{true};
+
+		uint64_t m_lastSampleNs = 0;
+		int64_t m_decodedPixelsPerSecond = 0;
+
+		Assignment m_assignment;
+	};
+
+	static int layerPixels(const Entry &entry, const int spatialLayer);
+	static int layerFramerate(const Entry &entry, const int temporalLayer);
+	static int64_t cost(const Entry &entry, const int spatialLayer, const int temporalLayer);
+
+	// Until a frame tells us otherwise
+	static int getDefaultTopLayerPixels() { return 1280 * 720; }
+	static int getDefaultStreamFramerate() { return 30; }
+
+	std::mutex m_mtx;
+	std::map<std::string, Entry> m_entries;
+	int64_t m_budget = 0;
+	int64_t m_scheduledPixelsPerSecond = 0;
+};
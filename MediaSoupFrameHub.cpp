@@ -0,0 +1,147 @@
+#ifndef _DEBUG
+
+#include "MediaSoupFrameHub.h"
+#include "MediaSoupInterface.h"
+#include "MediaSoupMailbox.h"
+
+#include <third_party/libyuv/include/libyuv.h>
+
+/**
+* MediaSoupFrameHub
+*/
+
+void MediaSoupFrameHub::subscribe(obs_source_t *source, const std::string &producerId)
+{
+	if (source == nullptr || producerId.empty())
+		return;
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_sources[source].m_producerIds.insert(producerId);
+}
+
+void MediaSoupFrameHub::unsubscribe(obs_source_t *source, const std::string &producerId)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	auto itr = m_sources.find(source);
+
+	if (itr == m_sources.end())
+		return;
+
+	itr->second.m_producerIds.erase(producerId);
+
+	if (itr->second.m_producerIds.empty())
+		m_sources.erase(itr);
+}
+
+void MediaSoupFrameHub::publish(obs_source_t *source, const std::string &producerId, const obs_source_frame *frame)
+{
+	rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+	std::vector<std::string> producerIds;
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+
+		SourceEntry &entry = m_sources[source];
+		entry.m_producerIds.insert(producerId);
+
+		// Another filter on this source already converted and published this frame
+		if (entry.m_published && entry.m_lastTimestamp == frame->timestamp && entry.m_lastWidth == frame->width && entry.m_lastHeight == frame->height)
+			return;
+
+		buffer = getFrameBuffer(entry, frame->width, frame->height);
+
+		if (!convertToI420(frame, *buffer))
+			return;
+
+		if (frame->flip)
+			buffer = webrtc::I420Buffer::Rotate(*buffer, webrtc::VideoRotation::kVideoRotation_180);
+
+		entry.m_lastTimestamp = frame->timestamp;
+		entry.m_lastWidth = frame->width;
+		entry.m_lastHeight = frame->height;
+		entry.m_published = true;
+		producerIds.assign(entry.m_producerIds.begin(), entry.m_producerIds.end());
+	}
+
+	for (auto &id : producerIds) {
+		if (!MediaSoupInterface::instance().getTransceiver()->ProducerReady(id))
+			continue;
+
+		if (auto mailbox = MediaSoupInterface::instance().getTransceiver()->GetProducerMailbox(id))
+			mailbox->push_outgoing_videoFrame(buffer);
+	}
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> MediaSoupFrameHub::getFrameBuffer(SourceEntry &entry, const int width, const int height)
+{
+	// Resolution changed, whoever still holds the old ones keeps them
+	if (!entry.m_buffers.empty() && (entry.m_buffers.front()->width() != width || entry.m_buffers.front()->height() != height))
+		entry.m_buffers.clear();
+
+	for (auto &itr : entry.m_buffers) {
+		// Only the pool references it, so no mailbox or encoder is using it
+		if (itr->HasOneRef())
+			return itr;
+	}
+
+	rtc::scoped_refptr<FrameBuffer> buffer = new FrameBuffer(width, height);
+
+	// Everything is in flight, a backed up encoder gets a buffer of its own rather than growing the pool
+	if (entry.m_buffers.size() < kMaxPooledBuffers)
+		entry.m_buffers.push_back(buffer);
+
+	return buffer;
+}
+
+bool MediaSoupFrameHub::convertToI420(const obs_source_frame *frame, webrtc::I420Buffer &dest)
+{
+	switch (frame->format) {
+	//VIDEO_FORMAT_Y800
+	//VIDEO_FORMAT_I40A
+	//VIDEO_FORMAT_I42A
+	//VIDEO_FORMAT_AYUV
+	//VIDEO_FORMAT_YVYU
+	case VIDEO_FORMAT_YUY2:
+		libyuv::YUY2ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(),
+				   dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_UYVY:
+		libyuv::UYVYToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(),
+				   dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_RGBA:
+		libyuv::RGBAToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(),
+				   dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_BGRA:
+		libyuv::ARGBToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(),
+				   dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_I422:
+		libyuv::I422ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]), frame->data[2],
+				   static_cast<int>(frame->linesize[2]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(), dest.StrideU(),
+				   dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_I444:
+		libyuv::I444ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]), frame->data[2],
+				   static_cast<int>(frame->linesize[2]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(), dest.StrideU(),
+				   dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	case VIDEO_FORMAT_NV12:
+		libyuv::NV12ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]),
+				   dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(), dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(),
+				   dest.height());
+		break;
+	case VIDEO_FORMAT_BGRX:
+		libyuv::ARGBToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest.MutableDataY(), dest.StrideY(), dest.MutableDataU(),
+				   dest.StrideU(), dest.MutableDataV(), dest.StrideV(), dest.width(), dest.height());
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "MediaSoupTransceiver.h"
+
+#include <obs.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+
+/**
+* MediaSoupFrameHub
+*/
+
+// Several producer filters can sit on the same OBS source (ie, a high quality producer and a low bitrate one)
+// The hub converts each source frame to I420 once and hands the same refcounted buffer to every producer subscribed to that source
+class MediaSoupFrameHub {
+public:
+	void subscribe(obs_source_t *source, const std::string &producerId);
+	void unsubscribe(obs_source_t *source, const std::string &producerId);
+	void publish(obs_source_t *source, const std::string &producerId, const obs_source_frame *frame);
+
+	static bool convertToI420(const obs_source_frame *frame, webrtc::I420Buffer &dest);
+
+private:
+	typedef rtc::RefCountedObject<webrtc::I420Buffer> FrameBuffer;
+
+	struct SourceEntry {
+		std::set<std::string> m_producerIds;
+
+		// Last frame published, an async and a sync filter on one source can see different sizes for the same timestamp
+		uint64_t m_lastTimestamp{0};
+		uint32_t m_lastWidth{0};
+		uint32_t m_lastHeight{0};
+		bool m_published{false};
+
+		// Mailboxes queue and encoders read these after publish returns, only one nobody else holds is written again
+		std::vector<rtc::scoped_refptr<FrameBuffer>> m_buffers;
+	};
+
+	rtc::scoped_refptr<webrtc::I420Buffer> getFrameBuffer(SourceEntry &entry, const int width, const int height);
+
+	static const size_t kMaxPooledBuffers = 4;
+
+	std::mutex m_mtx;
+	std::map<obs_source_t *, SourceEntry> m_sources;
+
+public:
+	static MediaSoupFrameHub &instance()
+	{
+		static MediaSoupFrameHub s;
+		return s;
+	}
+
+private:
+	MediaSoupFrameHub() {}
+	~MediaSoupFrameHub() {}
+};
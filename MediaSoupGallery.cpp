@@ -0,0 +1,354 @@
+#ifndef _DEBUG
+
+#include "MediaSoupGallery.h"
+#include "MediaSoupMailbox.h"
+#include "ConnectorFrontApi.h"
+
+#include <third_party/libyuv/include/libyuv.h>
+
+#include <algorithm>
+#include <cmath>
+
+/**
+* MediaSoupGallery
+*/
+
+MediaSoupGallery::MediaSoupGallery(obs_source_t *source) : m_source(source) {}
+
+MediaSoupGallery::~MediaSoupGallery()
+{
+	std::vector<Tile> tiles;
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+		tiles.swap(m_tiles);
+	}
+
+	for (auto &itr : tiles)
+		detachTile(itr);
+
+	obs_enter_graphics();
+	MediaSoupInterface::destroyDrawTexture(m_atlas);
+	obs_leave_graphics();
+}
+
+// Same as func_video_consumer_response on a connector source, the consumer just lands in a new tile
+bool MediaSoupGallery::createConsumer(const std::string &params, calldata_t *cd)
+{
+	std::string producerId;
+
+	try {
+		producerId = json::parse(params)["producerId"].get<std::string>();
+	} catch (...) {
+		blog(LOG_WARNING, "%s MediaSoupGallery::createConsumer bad json", obs_module_description());
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+
+		for (auto &itr : m_tiles) {
+			if (itr.m_producerId == producerId) {
+				blog(LOG_WARNING, "%s MediaSoupGallery::createConsumer '%s' already has a tile", obs_module_description(), producerId.c_str());
+				return false;
+			}
+		}
+	}
+
+	// The consumer thread may register against it later, so it's kept from here on
+	auto info = std::make_unique<MediaSoupInterface::ObsSourceInfo>();
+	info->m_obs_source = m_source;
+
+	if (!ConnectorFrontApiHelper::createConsumer(*info, params, "video", cd))
+		return false;
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	Tile tile;
+	tile.m_producerId = producerId;
+	tile.m_info = std::move(info);
+	m_tiles.push_back(std::move(tile));
+	m_layoutDirty = true;
+	return true;
+}
+
+// Sets the tiles and their order, attaching to consumers other sources already receive
+// Tiles for producers not in the list are dropped, and their consumers stop if nobody else shows them
+json MediaSoupGallery::setProducers(const std::vector<std::string> &producerIds)
+{
+	std::vector<Tile> removed;
+	json missing = json::array();
+	json tiles = json::array();
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+		std::vector<Tile> ordered;
+
+		for (auto &producerId : producerIds) {
+			auto existing = std::find_if(m_tiles.begin(), m_tiles.end(), [&producerId](const Tile &tile) { return tile.m_producerId == producerId; });
+
+			if (existing != m_tiles.end()) {
+				ordered.push_back(std::move(*existing));
+				m_tiles.erase(existing);
+				tiles.push_back(producerId);
+				continue;
+			}
+
+			auto info = std::make_unique<MediaSoupInterface::ObsSourceInfo>();
+			info->m_obs_source = m_source;
+			std::string consumerId;
+
+			if (!MediaSoupInterface::instance().attachToConsumer(*info, producerId, "video", consumerId)) {
+				missing.push_back(producerId);
+				continue;
+			}
+
+			Tile tile;
+			tile.m_producerId = producerId;
+			tile.m_info = std::move(info);
+			ordered.push_back(std::move(tile));
+			tiles.push_back(producerId);
+		}
+
+		removed.swap(m_tiles);
+		m_tiles.swap(ordered);
+		m_layoutDirty = true;
+	}
+
+	for (auto &itr : removed)
+		detachTile(itr);
+
+	json output;
+	output["tiles"] = tiles;
+	output["missing"] = missing;
+	return output;
+}
+
+void MediaSoupGallery::update(obs_data_t *settings)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	// Even, so centered tiles land on whole pixels
+	const int width = std::max(2, int(obs_data_get_int(settings, "canvas_width")) & ~1);
+	const int height = std::max(2, int(obs_data_get_int(settings, "canvas_height")) & ~1);
+
+	if (width == m_width && height == m_height)
+		return;
+
+	m_width = width;
+	m_height = height;
+	m_layoutDirty = true;
+}
+
+void MediaSoupGallery::tick(const float seconds)
+{
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+
+		for (auto &itr : m_tiles)
+			MediaSoupInterface::requestFirstKeyFrame(*itr.m_info);
+	}
+
+	m_wantsElapsed += seconds;
+
+	if (m_wantsElapsed < 0.5f)
+		return;
+
+	m_wantsElapsed = 0.f;
+
+	int width = 0;
+	int height = 0;
+	double canvasScale = 0.0;
+
+	// How much of the atlas actually reaches the canvas, each tile gets its share
+	if (MediaSoupInterface::getLargestOnCanvasSize(m_source, width, height) && width > 0 && height > 0)
+		canvasScale = (double(width) * double(height)) / (double(m_width) * double(m_height));
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	for (size_t i = 0; i < m_tiles.size(); ++i) {
+		MediaSoupInterface::ObsSourceInfo &info = *m_tiles[i].m_info;
+
+		int x = 0;
+		int y = 0;
+		int tileWidth = 0;
+		int tileHeight = 0;
+		getTileRect(i, x, y, tileWidth, tileHeight);
+
+		info.m_displayPixels = canvasScale > 0.0 ? std::max(1, int(double(tileWidth) * double(tileHeight) * canvasScale)) : 0;
+		MediaSoupInterface::updateConsumerPauseState(info);
+
+		if (MediaSoupInterface::instance().getTransceiver()->ConsumerReady(info.m_consumer_video))
+			MediaSoupInterface::reportConsumerDisplay(info);
+	}
+}
+
+void MediaSoupGallery::render()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	if (m_layoutDirty)
+		reflow();
+
+	for (size_t i = 0; i < m_tiles.size(); ++i) {
+		if (refreshTile(i))
+			m_atlasDirty = true;
+	}
+
+	// Uploaded only when a tile has a new frame, otherwise the last atlas is drawn again
+	if (m_atlasDirty) {
+		MediaSoupInterface::applyI420ToObsTexture(*m_atlasFrame, webrtc::kVideoRotation_0, m_atlas);
+		m_atlasDirty = false;
+	}
+
+	MediaSoupInterface::drawObsTexture(m_atlas, m_width, m_height);
+}
+
+// Everything is redrawn into a black atlas at the new layout
+void MediaSoupGallery::reflow()
+{
+	const int count = std::max(1, int(m_tiles.size()));
+	m_columns = int(std::ceil(std::sqrt(double(count))));
+	m_rows = (count + m_columns - 1) / m_columns;
+
+	if (m_atlasFrame == nullptr || m_atlasFrame->width() != m_width || m_atlasFrame->height() != m_height)
+		m_atlasFrame = webrtc::I420Buffer::Create(m_width, m_height);
+
+	webrtc::I420Buffer::SetBlack(m_atlasFrame.get());
+
+	for (auto &itr : m_tiles) {
+		itr.m_drawnSequence = 0;
+		itr.m_placedWidth = 0;
+		itr.m_placedHeight = 0;
+	}
+
+	m_layoutDirty = false;
+	m_atlasDirty = true;
+}
+
+// The last row is centered when it isn't full
+void MediaSoupGallery::getTileRect(const size_t index, int &x, int &y, int &width, int &height) const
+{
+	const int count = std::max(1, int(m_tiles.size()));
+	const int column = int(index) % m_columns;
+	const int row = int(index) / m_columns;
+	const int inRow = row == m_rows - 1 ? count - row * m_columns : m_columns;
+
+	width = m_width / m_columns;
+	height = m_height / m_rows;
+	x = (m_width - inRow * width) / 2 + column * width;
+	y = (m_height - m_rows * height) / 2 + row * height;
+}
+
+// True if the tile's frame changed since it was last written into the atlas
+bool MediaSoupGallery::refreshTile(const size_t index)
+{
+	Tile &tile = m_tiles[index];
+	MediaSoupTransceiver *transceiver = MediaSoupInterface::instance().getTransceiver();
+	const std::string &consumerId = tile.m_info->m_consumer_video;
+
+	if (consumerId.empty() || !transceiver->ConsumerReady(consumerId))
+		return false;
+
+	auto mailbox = transceiver->GetConsumerMailbox(consumerId);
+
+	if (mailbox == nullptr)
+		return false;
+
+	// Shared with any connector source showing the same consumer, whoever renders first pops the frame
+	std::shared_ptr<MediaSoupInterface::ConsumerView> view = std::atomic_load(&tile.m_info->m_view);
+	view->refresh(*mailbox);
+
+	if (!view->m_frame.has_value() || view->m_sequence == tile.m_drawnSequence)
+		return false;
+
+	if (!placeTile(index, view->m_frame.value()))
+		return false;
+
+	tile.m_drawnSequence = view->m_sequence;
+	return true;
+}
+
+// Letterboxed into the tile's rect, the sink already scales to about the tile's share of the canvas so this is usually a straight copy
+bool MediaSoupGallery::placeTile(const size_t index, const webrtc::VideoFrame &frame)
+{
+	Tile &tile = m_tiles[index];
+	rtc::scoped_refptr<webrtc::I420BufferInterface> source = frame.video_frame_buffer()->ToI420();
+
+	if (source == nullptr || source->width() <= 0 || source->height() <= 0)
+		return false;
+
+	int x = 0;
+	int y = 0;
+	int tileWidth = 0;
+	int tileHeight = 0;
+	getTileRect(index, x, y, tileWidth, tileHeight);
+
+	const bool sideways = frame.rotation() == webrtc::kVideoRotation_90 || frame.rotation() == webrtc::kVideoRotation_270;
+	const int displayWidth = sideways ? source->height() : source->width();
+	const int displayHeight = sideways ? source->width() : source->height();
+	const double scale = std::min(double(tileWidth) / double(displayWidth), double(tileHeight) / double(displayHeight));
+
+	// Even sizes and offsets, so chroma lines up and nothing spills into the next tile
+	int drawWidth = int(double(displayWidth) * scale) & ~1;
+	int drawHeight = int(double(displayHeight) * scale) & ~1;
+	const int drawX = (x + (tileWidth - drawWidth) / 2 + 1) & ~1;
+	const int drawY = (y + (tileHeight - drawHeight) / 2 + 1) & ~1;
+
+	if (drawX + drawWidth > x + tileWidth)
+		drawWidth -= 2;
+
+	if (drawY + drawHeight > y + tileHeight)
+		drawHeight -= 2;
+
+	if (drawWidth <= 0 || drawHeight <= 0)
+		return false;
+
+	if (drawX != tile.m_placedX || drawY != tile.m_placedY || drawWidth != tile.m_placedWidth || drawHeight != tile.m_placedHeight) {
+		libyuv::I420Rect(m_atlasFrame->MutableDataY(), m_atlasFrame->StrideY(), m_atlasFrame->MutableDataU(), m_atlasFrame->StrideU(),
+				 m_atlasFrame->MutableDataV(), m_atlasFrame->StrideV(), x, y, tileWidth, tileHeight, 16, 128, 128);
+
+		tile.m_placedX = drawX;
+		tile.m_placedY = drawY;
+		tile.m_placedWidth = drawWidth;
+		tile.m_placedHeight = drawHeight;
+	}
+
+	// Size before rotation
+	const int scaledWidth = sideways ? drawHeight : drawWidth;
+	const int scaledHeight = sideways ? drawWidth : drawHeight;
+	rtc::scoped_refptr<webrtc::I420BufferInterface> scaled = source;
+
+	if (source->width() != scaledWidth || source->height() != scaledHeight) {
+		if (m_scratch == nullptr || m_scratch->width() != scaledWidth || m_scratch->height() != scaledHeight)
+			m_scratch = webrtc::I420Buffer::Create(scaledWidth, scaledHeight);
+
+		libyuv::I420Scale(source->DataY(), source->StrideY(), source->DataU(), source->StrideU(), source->DataV(), source->StrideV(), source->width(),
+				  source->height(), m_scratch->MutableDataY(), m_scratch->StrideY(), m_scratch->MutableDataU(), m_scratch->StrideU(),
+				  m_scratch->MutableDataV(), m_scratch->StrideV(), scaledWidth, scaledHeight, libyuv::kFilterBox);
+
+		scaled = m_scratch;
+	}
+
+	uint8_t *dstY = m_atlasFrame->MutableDataY() + drawY * m_atlasFrame->StrideY() + drawX;
+	uint8_t *dstU = m_atlasFrame->MutableDataU() + (drawY / 2) * m_atlasFrame->StrideU() + drawX / 2;
+	uint8_t *dstV = m_atlasFrame->MutableDataV() + (drawY / 2) * m_atlasFrame->StrideV() + drawX / 2;
+
+	if (frame.rotation() == webrtc::kVideoRotation_0)
+		libyuv::I420Copy(scaled->DataY(), scaled->StrideY(), scaled->DataU(), scaled->StrideU(), scaled->DataV(), scaled->StrideV(), dstY,
+				 m_atlasFrame->StrideY(), dstU, m_atlasFrame->StrideU(), dstV, m_atlasFrame->StrideV(), drawWidth, drawHeight);
+	else
+		libyuv::I420Rotate(scaled->DataY(), scaled->StrideY(), scaled->DataU(), scaled->StrideU(), scaled->DataV(), scaled->StrideV(), dstY,
+				   m_atlasFrame->StrideY(), dstU, m_atlasFrame->StrideU(), dstV, m_atlasFrame->StrideV(), scaledWidth, scaledHeight,
+				   static_cast<libyuv::RotationMode>(frame.rotation()));
+
+	return true;
+}
+
+void MediaSoupGallery::detachTile(Tile &tile)
+{
+	if (tile.m_info != nullptr)
+		MediaSoupInterface::instance().detachSource(*tile.m_info);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MediaSoupInterface.h"
+
+#include <obs-module.h>
+#include <mutex>
+#include <vector>
+
+/**
+* MediaSoupGallery
+*/
+
+// One source showing several video consumers in a grid
+// Tiles are written into the sub-rects of one I420 atlas, so however many there are it's one upload and one draw
+class MediaSoupGallery {
+public:
+	MediaSoupGallery(obs_source_t *source);
+	~MediaSoupGallery();
+
+	bool createConsumer(const std::string &params, calldata_t *cd);
+	json setProducers(const std::vector<std::string> &producerIds);
+
+	void update(obs_data_t *settings);
+	void tick(const float seconds);
+	void render();
+
+	uint32_t getWidth() const { return uint32_t(m_width); }
+	uint32_t getHeight() const { return uint32_t(m_height); }
+
+	obs_source_t *getSource() const { return m_source; }
+
+private:
+	struct Tile {
+		std::string m_producerId;
+		std::unique_ptr<MediaSoupInterface::ObsSourceInfo> m_info;
+		uint64_t m_drawnSequence = 0;
+
+		// Where the frame was last written, the bars around it only need clearing when this changes
+		int m_placedX = 0;
+		int m_placedY = 0;
+		int m_placedWidth = 0;
+		int m_placedHeight = 0;
+	};
+
+	void reflow();
+	void getTileRect(const size_t index, int &x, int &y, int &width, int &height) const;
+	bool refreshTile(const size_t index);
+	bool placeTile(const size_t index, const webrtc::VideoFrame &frame);
+	void detachTile(Tile &tile);
+
+	std::mutex m_mtx;
+	std::vector<Tile> m_tiles;
+
+	obs_source_t *m_source{nullptr};
+	int m_width = 1920;
+	int m_height = 1080;
+	int m_columns = 1;
+	int m_rows = 1;
+
+	// Written on the cpu a tile at a time and uploaded whole, gs_texture_map discards whatever isn't written
+	rtc::scoped_refptr<webrtc::I420Buffer> m_atlasFrame;
+	rtc::scoped_refptr<webrtc::I420Buffer> m_scratch;
+	MediaSoupInterface::ObsVideoTexture m_atlas;
+	bool m_atlasDirty{true};
+	bool m_layoutDirty{true};
+	float m_wantsElapsed = 0.f;
+};
@@ -7,10 +7,16 @@
 #include <third_party/libyuv/include/libyuv.h>
 #include <api/video/i420_buffer.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 /**
 * MediaSoupInterface
 */
 
+gs_effect_t *MediaSoupInterface::m_i420Effect = nullptr;
+
 MediaSoupInterface::MediaSoupInterface()
 {
 	m_sourceCounter = 0;
@@ -41,50 +47,490 @@ void MediaSoupInterface::reset()
 
 	m_connectionThread = nullptr;
 
+	forgetAllConsumers();
 	m_transceiver = std::make_unique<MediaSoupTransceiver>();
 }
 
-void MediaSoupInterface::applyVideoFrameToObsTexture(webrtc::VideoFrame &frame, MediaSoupInterface::ObsSourceInfo &sourceInfo)
+void MediaSoupInterface::applyVideoFrameToObsTexture(const webrtc::VideoFrame &frame, MediaSoupInterface::ObsVideoTexture &texture)
 {
-	// The webrtc image buffer should be in I420 format already, so this is just grabbing a ref ptr to it
+	// The sink already copied it into an I420 scratch buffer, so this is just grabbing a ref ptr to it
 	rtc::scoped_refptr<webrtc::I420BufferInterface> i420buffer(frame.video_frame_buffer()->ToI420());
+	applyI420ToObsTexture(*i420buffer, frame.rotation(), texture);
+}
+
+void MediaSoupInterface::applyI420ToObsTexture(const webrtc::I420BufferInterface &i420buffer, const webrtc::VideoRotation rotation,
+					       MediaSoupInterface::ObsVideoTexture &texture)
+{
+	ensureDrawTexture(i420buffer.width(), i420buffer.height(), texture);
+	texture.m_rotation = rotation;
+
+	const int chromaWidth = i420buffer.ChromaWidth();
+	const int chromaHeight = i420buffer.ChromaHeight();
+
+	uploadPlane(texture.m_planes[0], i420buffer.DataY(), i420buffer.StrideY(), i420buffer.width(), i420buffer.height());
+	uploadPlane(texture.m_planes[1], i420buffer.DataU(), i420buffer.StrideU(), chromaWidth, chromaHeight);
+	uploadPlane(texture.m_planes[2], i420buffer.DataV(), i420buffer.StrideV(), chromaWidth, chromaHeight);
+}
+
+// Writes straight into the mapped dynamic texture, no staging copy
+void MediaSoupInterface::uploadPlane(gs_texture_t *plane, const uint8_t *data, const int stride, const int width, const int height)
+{
+	uint8_t *ptr = nullptr;
+	uint32_t linesize = 0;
+
+	if (plane == nullptr || !gs_texture_map(plane, &ptr, &linesize))
+		return;
+
+	libyuv::CopyPlane(data, stride, ptr, static_cast<int>(linesize), width, height);
+	gs_texture_unmap(plane);
+}
+
+void MediaSoupInterface::ensureDrawTexture(const int w, const int h, MediaSoupInterface::ObsVideoTexture &texture)
+{
+	if (texture.m_width == w && texture.m_height == h && texture.m_planes[0] != nullptr)
+		return;
+
+	destroyDrawTexture(texture);
+
+	texture.m_width = w;
+	texture.m_height = h;
+
+	const int chromaWidth = (w + 1) / 2;
+	const int chromaHeight = (h + 1) / 2;
+
+	texture.m_planes[0] = gs_texture_create(w, h, GS_R8, 1, NULL, GS_DYNAMIC);
+	texture.m_planes[1] = gs_texture_create(chromaWidth, chromaHeight, GS_R8, 1, NULL, GS_DYNAMIC);
+	texture.m_planes[2] = gs_texture_create(chromaWidth, chromaHeight, GS_R8, 1, NULL, GS_DYNAMIC);
+}
+
+void MediaSoupInterface::destroyDrawTexture(MediaSoupInterface::ObsVideoTexture &texture)
+{
+	for (auto &plane : texture.m_planes) {
+		if (plane != nullptr)
+			gs_texture_destroy(plane);
+
+		plane = nullptr;
+	}
+
+	texture.m_width = 0;
+	texture.m_height = 0;
+}
+
+// The canvas if one was configured, otherwise the stream's size as displayed (after rotation)
+int MediaSoupInterface::getSourceWidth(const MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	if (sourceInfo.m_canvasWidth > 0 && sourceInfo.m_canvasHeight > 0)
+		return sourceInfo.m_canvasWidth;
+
+	const std::shared_ptr<ConsumerView> viewRef = std::atomic_load(&sourceInfo.m_view);
+	const ConsumerView &view = *viewRef;
+
+	if (view.m_nativeWidth <= 0 || view.m_nativeHeight <= 0)
+		return getDefaultObsTextureWidth();
+
+	const webrtc::VideoRotation rotation = view.m_texture.m_rotation;
+
+	if (rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270)
+		return view.m_nativeHeight;
+
+	return view.m_nativeWidth;
+}
+
+int MediaSoupInterface::getSourceHeight(const MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	if (sourceInfo.m_canvasWidth > 0 && sourceInfo.m_canvasHeight > 0)
+		return sourceInfo.m_canvasHeight;
+
+	const std::shared_ptr<ConsumerView> viewRef = std::atomic_load(&sourceInfo.m_view);
+	const ConsumerView &view = *viewRef;
+
+	if (view.m_nativeWidth <= 0 || view.m_nativeHeight <= 0)
+		return getDefaultObsTextureHeight();
+
+	const webrtc::VideoRotation rotation = view.m_texture.m_rotation;
+
+	if (rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270)
+		return view.m_nativeWidth;
+
+	return view.m_nativeHeight;
+}
+
+struct OnCanvasSearch {
+	obs_source_t *source{nullptr};
+	vec2 parentScale;
+	float width = 0.f;
+	float height = 0.f;
+	bool found = false;
+};
+
+static bool enumOnCanvasItems(obs_scene_t *scene, obs_sceneitem_t *item, void *param)
+{
+	UNUSED_PARAMETER(scene);
+	OnCanvasSearch *search = static_cast<OnCanvasSearch *>(param);
+
+	if (!obs_sceneitem_visible(item))
+		return true;
+
+	vec2 scale;
+	obs_sceneitem_get_scale(item, &scale);
+
+	if (obs_sceneitem_is_group(item)) {
+		vec2 parentScale = search->parentScale;
+		search->parentScale.x *= scale.x;
+		search->parentScale.y *= scale.y;
+		obs_sceneitem_group_enum_items(item, enumOnCanvasItems, param);
+		search->parentScale = parentScale;
+		return true;
+	}
+
+	if (obs_sceneitem_get_source(item) != search->source)
+		return true;
+
+	float width = 0.f;
+	float height = 0.f;
+
+	if (obs_sceneitem_get_bounds_type(item) != OBS_BOUNDS_NONE) {
+		vec2 bounds;
+		obs_sceneitem_get_bounds(item, &bounds);
+		width = bounds.x;
+		height = bounds.y;
+	} else {
+		width = float(obs_source_get_width(search->source)) * fabsf(scale.x);
+		height = float(obs_source_get_height(search->source)) * fabsf(scale.y);
+	}
+
+	width *= fabsf(search->parentScale.x);
+	height *= fabsf(search->parentScale.y);
+
+	if (width * height > search->width * search->height) {
+		search->width = width;
+		search->height = height;
+	}
+
+	search->found = true;
+	return true;
+}
+
+static bool enumOnCanvasScenes(void *param, obs_source_t *sceneSource)
+{
+	if (obs_scene_t *scene = obs_scene_from_source(sceneSource))
+		obs_scene_enum_items(scene, enumOnCanvasItems, param);
+
+	return true;
+}
+
+// Largest size the source is drawn at across all scenes, false when it isn't in any
+bool MediaSoupInterface::getLargestOnCanvasSize(obs_source_t *source, int &width, int &height)
+{
+	OnCanvasSearch search;
+	search.source = source;
+	vec2_set(&search.parentScale, 1.f, 1.f);
 
-	if (frame.rotation() != webrtc::kVideoRotation_0)
-		i420buffer = webrtc::I420Buffer::Rotate(*i420buffer, frame.rotation());
+	obs_enum_scenes(enumOnCanvasScenes, &search);
 
-	float extraWidth = float(getHardObsTextureWidth()) / float(i420buffer->width());
-	float extraHeight = float(getHardObsTextureHeight()) / float(i420buffer->height());
-	float scale = std::min(extraWidth, extraHeight);
+	width = int(ceilf(search.width));
+	height = int(ceilf(search.height));
+	return search.found;
+}
+
+// Hidden participants then cost no decode or conversion, the front end is expected to pause the server side consumer too
+void MediaSoupInterface::updateConsumerPauseState(MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	sourceInfo.m_hidden = !obs_source_active(sourceInfo.m_obs_source) && !obs_source_showing(sourceInfo.m_obs_source);
 
-	// Scale
-	int width = int(float(i420buffer->width()) * scale);
-	int height = int(float(i420buffer->height()) * scale);
-	i420buffer = rtc::scoped_refptr<webrtc::I420BufferInterface>(i420buffer->Scale(width, height)->ToI420());
+	for (auto &id : {sourceInfo.m_consumer_video, sourceInfo.m_consumer_audio}) {
+		if (id.empty() || !instance().getTransceiver()->ConsumerReady(id))
+			continue;
 
-	int biBitCount = 32;
-	int biSizeImage = i420buffer->width() * i420buffer->height() * (biBitCount >> 3);
+		// Recordings keep going while nobody is looking
+		const bool paused = !instance().isConsumerShown(id, sourceInfo) && !instance().getTransceiver()->ConsumerRecording(id);
 
-	std::unique_ptr<uint8_t[]> abgrBuffer;
-	abgrBuffer.reset(new uint8_t[biSizeImage]);
-	libyuv::I420ToABGR(i420buffer->DataY(), i420buffer->StrideY(), i420buffer->DataU(), i420buffer->StrideU(), i420buffer->DataV(), i420buffer->StrideV(),
-			   abgrBuffer.get(), i420buffer->width() * biBitCount / 8, i420buffer->width(), i420buffer->height());
+		if (instance().getTransceiver()->ConsumerPaused(id) == paused)
+			continue;
 
-	ensureDrawTexture(i420buffer->width(), i420buffer->height(), sourceInfo);
-	gs_texture_set_image(sourceInfo.m_obs_scene_texture, abgrBuffer.get(), i420buffer->width() * 4, false);
+		if (!instance().getTransceiver()->SetConsumerPaused(id, paused))
+			continue;
+
+		blog(LOG_INFO, "MediaSoupInterface::updateConsumerPauseState - %s consumer '%s'", paused ? "Paused" : "Resumed", id.c_str());
+		signalConsumerPaused(sourceInfo, id, id == sourceInfo.m_consumer_video ? "video" : "audio", paused);
+	}
 }
 
-void MediaSoupInterface::ensureDrawTexture(const int w, const int h, MediaSoupInterface::ObsSourceInfo &sourceInfo)
+// Every source showing the consumer hears about it, whichever one the front end is listening on
+void MediaSoupInterface::signalConsumerPaused(const ObsSourceInfo &sourceInfo, const std::string &consumerId, const char *kind, const bool paused)
 {
-	if (sourceInfo.m_textureWidth == w && sourceInfo.m_textureHeight == h && sourceInfo.m_obs_scene_texture != nullptr)
+	std::vector<obs_source_t *> sources;
+
+	{
+		std::lock_guard<std::mutex> grd(instance().m_registryMtx);
+
+		for (auto &itr : instance().m_consumerRegistry) {
+			if (itr.second.m_consumerId != consumerId)
+				continue;
+
+			for (auto source : itr.second.m_sources) {
+				if (std::find(sources.begin(), sources.end(), source->m_obs_source) == sources.end())
+					sources.push_back(source->m_obs_source);
+			}
+		}
+	}
+
+	if (std::find(sources.begin(), sources.end(), sourceInfo.m_obs_source) == sources.end())
+		sources.push_back(sourceInfo.m_obs_source);
+
+	for (auto source : sources) {
+		if (source == nullptr)
+			continue;
+
+		calldata_t cd = {};
+		calldata_set_ptr(&cd, "source", source);
+		calldata_set_string(&cd, "id", consumerId.c_str());
+		calldata_set_string(&cd, "kind", kind);
+		calldata_set_bool(&cd, "paused", paused);
+		signal_handler_signal(obs_source_get_signal_handler(source), "consumer_paused", &cd);
+		calldata_free(&cd);
+	}
+}
+
+// Only the texture drawn sources, async ones are drawn by obs and the gallery has its own atlas
+void MediaSoupInterface::prepareConsumerView(MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	const char *id = sourceInfo.m_obs_source != nullptr ? obs_source_get_id(sourceInfo.m_obs_source) : nullptr;
+
+	if (id == nullptr || strcmp(id, "mediasoupconnector") != 0)
 		return;
 
-	sourceInfo.m_textureWidth = w;
-	sourceInfo.m_textureHeight = h;
+	std::shared_ptr<ConsumerView> view = std::atomic_load(&sourceInfo.m_view);
+
+	// The last stream's size if this view had one, otherwise what the decode scheduler will ask for, the size it's shown at
+	int width = view->m_nativeWidth;
+	int height = view->m_nativeHeight;
+
+	if (width <= 0 || height <= 0) {
+		if (!getLargestOnCanvasSize(sourceInfo.m_obs_source, width, height) || width <= 0 || height <= 0) {
+			width = sourceInfo.m_canvasWidth;
+			height = sourceInfo.m_canvasHeight;
+		}
+
+		if (width <= 0 || height <= 0) {
+			width = getDefaultObsTextureWidth();
+			height = getDefaultObsTextureHeight();
+		}
+	}
+
+	obs_enter_graphics();
+	ensureDrawTexture(width, height, view->m_texture);
+	obs_leave_graphics();
+}
+
+// Until the first frame, checked a few times a second so the render thread rarely takes the transceiver's lock
+// m_consumer_video is set before the consumer exists, one that still doesn't after getFirstFrameConsumerTimeoutNs failed to be created
+void MediaSoupInterface::requestFirstKeyFrame(MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	if (sourceInfo.m_consumer_video.empty() || sourceInfo.m_firstFrameConsumer == sourceInfo.m_consumer_video)
+		return;
+
+	const uint64_t now = os_gettime_ns();
+
+	if (sourceInfo.m_firstFrameWaiting != sourceInfo.m_consumer_video) {
+		sourceInfo.m_firstFrameWaiting = sourceInfo.m_consumer_video;
+		sourceInfo.m_firstFrameWaitNs = now;
+		sourceInfo.m_firstFrameCheckNs = 0;
+	}
+
+	if (now - sourceInfo.m_firstFrameCheckNs < getFirstFrameCheckNs())
+		return;
+
+	sourceInfo.m_firstFrameCheckNs = now;
+
+	switch (instance().getTransceiver()->RequestFirstKeyFrame(sourceInfo.m_consumer_video)) {
+	case MediaSoupTransceiver::FirstFrameReceived:
+		sourceInfo.m_firstFrameConsumer = sourceInfo.m_consumer_video;
+		break;
+	case MediaSoupTransceiver::FirstFrameNoConsumer:
+		if (now - sourceInfo.m_firstFrameWaitNs < getFirstFrameConsumerTimeoutNs())
+			break;
+
+		blog(LOG_WARNING, "MediaSoupInterface::requestFirstKeyFrame - Consumer '%s' was never created, no longer waiting on it",
+		     sourceInfo.m_consumer_video.c_str());
+		sourceInfo.m_firstFrameConsumer = sourceInfo.m_consumer_video;
+		break;
+	default:
+		break;
+	}
+}
+
+// Throttled, scene items don't get resized every frame
+void MediaSoupInterface::updateConsumerSinkWants(MediaSoupInterface::ObsSourceInfo &sourceInfo, const float seconds)
+{
+	requestFirstKeyFrame(sourceInfo);
+
+	sourceInfo.m_wantsElapsed += seconds;
+
+	if (sourceInfo.m_wantsElapsed < 0.5f)
+		return;
+
+	sourceInfo.m_wantsElapsed = 0.f;
+
+	// Consumers created while the source was already hidden
+	updateConsumerPauseState(sourceInfo);
+
+	instance().getTransceiver()->SetJitterPartners(sourceInfo.m_consumer_video, sourceInfo.m_consumer_audio);
+
+	if (sourceInfo.m_consumer_video.empty() || !instance().getTransceiver()->ConsumerReady(sourceInfo.m_consumer_video))
+		return;
+
+	int width = 0;
+	int height = 0;
+
+	// Not in a scene, keep full size so it's right the moment it's added
+	sourceInfo.m_displayPixels = 0;
+
+	if (getLargestOnCanvasSize(sourceInfo.m_obs_source, width, height) && width > 0 && height > 0)
+		sourceInfo.m_displayPixels = width * height;
+
+	reportConsumerDisplay(sourceInfo);
+}
+
+// The decode scheduler turns this into layer requests and local wants, within the budget shared by every consumer
+void MediaSoupInterface::reportConsumerDisplay(MediaSoupInterface::ObsSourceInfo &sourceInfo)
+{
+	int framerate = 0;
+	obs_video_info ovi;
+
+	if (obs_get_video_info(&ovi) && ovi.fps_den > 0)
+		framerate = int(ceil(double(ovi.fps_num) / double(ovi.fps_den)));
+
+	// Other sources sharing the consumer count too, whichever shows it biggest wins
+	instance().getTransceiver()->UpdateConsumerDisplay(sourceInfo.m_consumer_video, instance().getConsumerDisplayPixels(sourceInfo.m_consumer_video, sourceInfo),
+							   framerate, instance().isConsumerShown(sourceInfo.m_consumer_video, sourceInfo));
+}
+
+// Fits the (rotated) frame into the box, centered, scaling happens on the gpu
+void MediaSoupInterface::drawObsTexture(const MediaSoupInterface::ObsVideoTexture &texture, const int boxWidth, const int boxHeight)
+{
+	if (texture.m_planes[0] == nullptr || texture.m_width <= 0 || texture.m_height <= 0)
+		return;
+
+	gs_effect_t *effect = getI420Effect();
+
+	if (effect == nullptr)
+		return;
+
+	const bool sideways = texture.m_rotation == webrtc::kVideoRotation_90 || texture.m_rotation == webrtc::kVideoRotation_270;
+	const float displayWidth = float(sideways ? texture.m_height : texture.m_width);
+	const float displayHeight = float(sideways ? texture.m_width : texture.m_height);
+	const float scale = std::min(float(boxWidth) / displayWidth, float(boxHeight) / displayHeight);
+	const float drawWidth = displayWidth * scale;
+	const float drawHeight = displayHeight * scale;
+
+	// Sprite size before rotation
+	const float spriteWidth = sideways ? drawHeight : drawWidth;
+	const float spriteHeight = sideways ? drawWidth : drawHeight;
+
+	gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
+
+	gs_enable_framebuffer_srgb(false);
+	gs_enable_blending(false);
+
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), texture.m_planes[0]);
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image_u"), texture.m_planes[1]);
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image_v"), texture.m_planes[2]);
 
-	if (sourceInfo.m_obs_scene_texture != nullptr)
-		gs_texture_destroy(sourceInfo.m_obs_scene_texture);
+	gs_technique_begin(tech);
 
-	sourceInfo.m_obs_scene_texture = gs_texture_create(w, h, GS_RGBA, 1, NULL, GS_DYNAMIC);
+	if (gs_technique_begin_pass(tech, 0)) {
+		gs_matrix_push();
+		gs_matrix_translate3f((float(boxWidth) - drawWidth) / 2.0f + drawWidth / 2.0f, (float(boxHeight) - drawHeight) / 2.0f + drawHeight / 2.0f,
+				      0.0f);
+
+		if (texture.m_rotation != webrtc::kVideoRotation_0)
+			gs_matrix_rotaa4f(0.0f, 0.0f, 1.0f, RAD(float(texture.m_rotation)));
+
+		gs_matrix_translate3f(-spriteWidth / 2.0f, -spriteHeight / 2.0f, 0.0f);
+		gs_draw_sprite(texture.m_planes[0], 0, uint32_t(spriteWidth), uint32_t(spriteHeight));
+		gs_matrix_pop();
+
+		gs_technique_end_pass(tech);
+	}
+
+	gs_technique_end(tech);
+	gs_enable_blending(true);
+}
+
+gs_effect_t *MediaSoupInterface::getI420Effect()
+{
+	// BT.601 limited range, which is what webrtc's decoders hand us
+	static const char *effectString = R"(
+uniform float4x4 ViewProj;
+uniform texture2d image;
+uniform texture2d image_u;
+uniform texture2d image_v;
+
+sampler_state def_sampler {
+	Filter   = Linear;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+struct VertInOut {
+	float4 pos : POSITION;
+	float2 uv  : TEXCOORD0;
+};
+
+VertInOut VSDefault(VertInOut vert_in)
+{
+	VertInOut vert_out;
+	vert_out.pos = mul(float4(vert_in.pos.xyz, 1.0), ViewProj);
+	vert_out.uv  = vert_in.uv;
+	return vert_out;
+}
+
+float4 PSI420(VertInOut vert_in) : TARGET
+{
+	float3 yuv = float3(image.Sample(def_sampler, vert_in.uv).r, image_u.Sample(def_sampler, vert_in.uv).r,
+			    image_v.Sample(def_sampler, vert_in.uv).r);
+	yuv -= float3(0.062745, 0.501961, 0.501961);
+
+	float3 rgb = float3(dot(yuv, float3(1.164384, 0.0, 1.596027)),
+			    dot(yuv, float3(1.164384, -0.391762, -0.812968)),
+			    dot(yuv, float3(1.164384, 2.017232, 0.0)));
+
+	return float4(saturate(rgb), 1.0);
+}
+
+technique Draw
+{
+	pass
+	{
+		vertex_shader = VSDefault(vert_in);
+		pixel_shader  = PSI420(vert_in);
+	}
+}
+)";
+
+	if (m_i420Effect != nullptr)
+		return m_i420Effect;
+
+	char *errors = nullptr;
+	m_i420Effect = gs_effect_create(effectString, "mediasoup_i420.effect", &errors);
+
+	if (m_i420Effect == nullptr)
+		blog(LOG_ERROR, "MediaSoupInterface::getI420Effect - Failed to compile '%s'", errors != nullptr ? errors : "");
+
+	bfree(errors);
+	return m_i420Effect;
+}
+
+void MediaSoupInterface::destroyGraphics()
+{
+	if (m_i420Effect == nullptr)
+		return;
+
+	obs_enter_graphics();
+	gs_effect_destroy(m_i420Effect);
+	m_i420Effect = nullptr;
+	obs_leave_graphics();
 }
 
 void MediaSoupInterface::joinWaitingThread()
@@ -95,6 +541,254 @@ void MediaSoupInterface::joinWaitingThread()
 	m_connectionThread = nullptr;
 }
 
+/**
+* MediaSoupInterface::ConsumerView
+*/
+
+MediaSoupInterface::ConsumerView::~ConsumerView()
+{
+	if (m_texture.m_planes[0] == nullptr)
+		return;
+
+	obs_enter_graphics();
+	destroyDrawTexture(m_texture);
+	obs_leave_graphics();
+}
+
+// Render thread only, frames wait here until the frame obs is composing reaches their presentation time
+void MediaSoupInterface::ConsumerView::refresh(MediaSoupMailbox &mailbox)
+{
+	const webrtc::VideoFrame *frame = mailbox.pop_received_videoFrame();
+	mailbox.get_received_videoNativeSize(m_nativeWidth, m_nativeHeight);
+
+	if (frame != nullptr) {
+		m_pending.emplace_back(MediaSoupSyncEngine::instance().getVideoPresentationTime(*frame), *frame);
+
+		// Too far behind, the oldest won't be shown anyway
+		if (m_pending.size() > kMaxPendingFrames)
+			m_pending.pop_front();
+	}
+
+	const uint64_t now = obs_get_video_frame_time();
+	bool advanced = false;
+
+	while (!m_pending.empty() && m_pending.front().first <= now) {
+		m_frame = std::move(m_pending.front().second);
+		m_pending.pop_front();
+		advanced = true;
+	}
+
+	if (advanced)
+		++m_sequence;
+}
+
+// Once per new frame, however many sources draw it
+void MediaSoupInterface::ConsumerView::upload()
+{
+	if (!m_frame.has_value() || m_uploadedSequence == m_sequence)
+		return;
+
+	applyVideoFrameToObsTexture(*m_frame, m_texture);
+	m_uploadedSequence = m_sequence;
+}
+
+/**
+* MediaSoupInterface (consumer registry)
+*/
+
+// Async sources get their frames pushed by the sink, so they can't share a video consumer with the texture based ones
+std::string MediaSoupInterface::getRegistryKey(const std::string &producerId, const std::string &kind, obs_source_t *source)
+{
+	if (kind == "video" && isAsyncVideoSource(source))
+		return kind + ":async:" + producerId;
+
+	return kind + ":" + producerId;
+}
+
+bool MediaSoupInterface::attachToConsumer(ObsSourceInfo &sourceInfo, const std::string &producerId, const std::string &kind, std::string &output_consumerId)
+{
+	// Async sources are pushed to directly, a second one would never see a frame
+	if (kind == "video" && isAsyncVideoSource(sourceInfo.m_obs_source))
+		return false;
+
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	auto itr = m_consumerRegistry.find(getRegistryKey(producerId, kind, sourceInfo.m_obs_source));
+
+	if (itr == m_consumerRegistry.end() || !m_transceiver->ConsumerReady(itr->second.m_consumerId))
+		return false;
+
+	SharedConsumer &shared = itr->second;
+
+	if (std::find(shared.m_sources.begin(), shared.m_sources.end(), &sourceInfo) == shared.m_sources.end())
+		shared.m_sources.push_back(&sourceInfo);
+
+	if (kind == "video") {
+		sourceInfo.m_consumer_video = shared.m_consumerId;
+		std::atomic_store(&sourceInfo.m_view, shared.m_view);
+	} else {
+		sourceInfo.m_consumer_audio = shared.m_consumerId;
+	}
+
+	output_consumerId = shared.m_consumerId;
+	blog(LOG_INFO, "MediaSoupInterface::attachToConsumer - %s consumer '%s' now shown by %d sources", kind.c_str(), output_consumerId.c_str(),
+	     int(shared.m_sources.size()));
+	return true;
+}
+
+void MediaSoupInterface::registerConsumer(ObsSourceInfo &sourceInfo, const std::string &producerId, const std::string &kind, const std::string &consumerId)
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	SharedConsumer &shared = m_consumerRegistry[getRegistryKey(producerId, kind, sourceInfo.m_obs_source)];
+	shared.m_consumerId = consumerId;
+	shared.m_sources = {&sourceInfo};
+	shared.m_view = kind == "video" ? std::atomic_load(&sourceInfo.m_view) : nullptr;
+	shared.m_audioTarget = kind == "audio" ? &sourceInfo : nullptr;
+}
+
+// The consumer is only stopped once the last source showing it goes away
+void MediaSoupInterface::detachSource(ObsSourceInfo &sourceInfo)
+{
+	std::vector<std::string> unused;
+
+	{
+		std::lock_guard<std::mutex> grd(m_registryMtx);
+
+		for (auto itr = m_consumerRegistry.begin(); itr != m_consumerRegistry.end();) {
+			SharedConsumer &shared = itr->second;
+			auto found = std::find(shared.m_sources.begin(), shared.m_sources.end(), &sourceInfo);
+
+			if (found == shared.m_sources.end()) {
+				++itr;
+				continue;
+			}
+
+			shared.m_sources.erase(found);
+
+			if (shared.m_sources.empty()) {
+				unused.push_back(shared.m_consumerId);
+				itr = m_consumerRegistry.erase(itr);
+				continue;
+			}
+
+			// Audio only goes out through one source, if it was this one hand it to someone still attached
+			if (shared.m_audioTarget == &sourceInfo) {
+				shared.m_audioTarget = shared.m_sources.front();
+				m_transceiver->SetConsumerAudioSource(shared.m_consumerId, shared.m_audioTarget->m_obs_source);
+			}
+
+			++itr;
+		}
+	}
+
+	// Not registered (ie, created before the registry knew about it) is treated as unshared
+	for (auto &id : {sourceInfo.m_consumer_audio, sourceInfo.m_consumer_video}) {
+		if (!id.empty() && std::find(unused.begin(), unused.end(), id) == unused.end() && !isConsumerRegistered(id))
+			unused.push_back(id);
+	}
+
+	for (auto &id : unused)
+		m_transceiver->StopConsumerById(id);
+
+	sourceInfo.m_consumer_audio.clear();
+	sourceInfo.m_consumer_video.clear();
+	std::atomic_store(&sourceInfo.m_view, std::make_shared<ConsumerView>());
+}
+
+// Stopped from the front end, every source showing it lets go
+void MediaSoupInterface::forgetConsumer(const std::string &consumerId)
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	for (auto itr = m_consumerRegistry.begin(); itr != m_consumerRegistry.end();) {
+		if (itr->second.m_consumerId != consumerId) {
+			++itr;
+			continue;
+		}
+
+		for (auto source : itr->second.m_sources) {
+			if (source->m_consumer_audio == consumerId)
+				source->m_consumer_audio.clear();
+
+			if (source->m_consumer_video == consumerId)
+				source->m_consumer_video.clear();
+		}
+
+		itr = m_consumerRegistry.erase(itr);
+	}
+}
+
+void MediaSoupInterface::forgetAllConsumers()
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	for (auto &itr : m_consumerRegistry) {
+		for (auto source : itr.second.m_sources) {
+			source->m_consumer_audio.clear();
+			source->m_consumer_video.clear();
+		}
+	}
+
+	m_consumerRegistry.clear();
+}
+
+bool MediaSoupInterface::isConsumerRegistered(const std::string &consumerId)
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	for (auto &itr : m_consumerRegistry) {
+		if (itr.second.m_consumerId == consumerId)
+			return true;
+	}
+
+	return false;
+}
+
+// True while any source attached to the consumer is active or showing
+bool MediaSoupInterface::isConsumerShown(const std::string &consumerId, const ObsSourceInfo &sourceInfo)
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	for (auto &itr : m_consumerRegistry) {
+		if (itr.second.m_consumerId != consumerId)
+			continue;
+
+		for (auto source : itr.second.m_sources) {
+			if (!source->m_hidden)
+				return true;
+		}
+
+		return false;
+	}
+
+	return !sourceInfo.m_hidden;
+}
+
+int MediaSoupInterface::getConsumerDisplayPixels(const std::string &consumerId, const ObsSourceInfo &sourceInfo)
+{
+	std::lock_guard<std::mutex> grd(m_registryMtx);
+
+	for (auto &itr : m_consumerRegistry) {
+		if (itr.second.m_consumerId != consumerId)
+			continue;
+
+		int result = 0;
+
+		for (auto source : itr.second.m_sources) {
+			// 0 is "not measured", which means full size
+			if (source->m_displayPixels == 0)
+				return 0;
+
+			result = std::max(result, source->m_displayPixels);
+		}
+
+		return result;
+	}
+
+	return sourceInfo.m_displayPixels;
+}
+
 void MediaSoupInterface::resetThreadCache()
 {
 	m_connectWaiting = false;
@@ -2,7 +2,11 @@
 
 #include "MediaSoupTransceiver.h"
 
+#include "absl/types/optional.h"
+
 #include <obs.h>
+#include <deque>
+#include <map>
 #include <mutex>
 
 /**
@@ -11,13 +15,72 @@
 
 class MediaSoupInterface {
 public:
+	// Y, U and V planes uploaded as is, the shader does the conversion and the draw transform does the rotation
+	struct ObsVideoTexture {
+		gs_texture_t *m_planes[3]{nullptr, nullptr, nullptr};
+		int m_width = 0;
+		int m_height = 0;
+		webrtc::VideoRotation m_rotation = webrtc::kVideoRotation_0;
+	};
+
+	// Decoded video of one consumer, shared by every source showing it
+	struct ConsumerView {
+		~ConsumerView();
+
+		// Takes the latest frame from the mailbox, the first caller after a new frame gets it for everyone
+		void refresh(MediaSoupMailbox &mailbox);
+
+		// Textures are only made for views that are drawn directly (the gallery reads m_frame instead)
+		void upload();
+
+		absl::optional<webrtc::VideoFrame> m_frame;
+		ObsVideoTexture m_texture;
+
+		// Popped but not due yet, with their presentation time on the obs clock
+		std::deque<std::pair<uint64_t, webrtc::VideoFrame>> m_pending;
+		static const size_t kMaxPendingFrames = 3;
+
+		// Decoded size before any display scaling, m_texture can be smaller
+		int m_nativeWidth = 0;
+		int m_nativeHeight = 0;
+		// Bumped each time m_frame changes
+		uint64_t m_sequence = 0;
+		uint64_t m_uploadedSequence = 0;
+	};
+
 	struct ObsSourceInfo {
 		obs_source_t *m_obs_source{nullptr};
-		gs_texture_t *m_obs_scene_texture{nullptr};
+		// Swapped from the ui thread when attaching, read with std::atomic_load
+		std::shared_ptr<ConsumerView> m_view{std::make_shared<ConsumerView>()};
 		std::string m_consumer_audio;
 		std::string m_consumer_video;
-		int m_textureWidth = 0;
-		int m_textureHeight = 0;
+
+		// 0 means follow the stream's native size
+		int m_canvasWidth = 0;
+		int m_canvasHeight = 0;
+
+		// Not in an active or showing scene, its consumers pause once no other source shows them either
+		bool m_hidden{false};
+
+		// Largest on-canvas size, and the time since it was last reported for m_consumer_video
+		int m_displayPixels = 0;
+		float m_wantsElapsed = 0.f;
+
+		// m_consumer_video once it has delivered a frame (or was never created), until then keyframes are requested
+		std::string m_firstFrameConsumer;
+		std::string m_firstFrameWaiting;
+		uint64_t m_firstFrameWaitNs = 0;
+		uint64_t m_firstFrameCheckNs = 0;
+	};
+
+	// Sources showing the same remote producer share one consumer, one sink and one view
+	struct SharedConsumer {
+		std::string m_consumerId;
+		std::vector<ObsSourceInfo *> m_sources;
+		std::shared_ptr<ConsumerView> m_view;
+
+		// Audio goes out through this one source only, null for video
+		ObsSourceInfo *m_audioTarget{nullptr};
 	};
 
 public:
@@ -34,8 +97,12 @@ public:
 	void setExpectingProduceFollowup(const bool v) { m_expectingProduceFollowup = v; }
 	void setConnectionThread(std::unique_ptr<std::thread> thr) { m_connectionThread = std::move(thr); }
 
-	static void applyVideoFrameToObsTexture(webrtc::VideoFrame &frame, ObsSourceInfo &sourceInfo);
-	static void ensureDrawTexture(const int width, const int height, ObsSourceInfo &sourceInfo);
+	static void applyVideoFrameToObsTexture(const webrtc::VideoFrame &frame, ObsVideoTexture &texture);
+	static void applyI420ToObsTexture(const webrtc::I420BufferInterface &buffer, const webrtc::VideoRotation rotation, ObsVideoTexture &texture);
+	static void ensureDrawTexture(const int width, const int height, ObsVideoTexture &texture);
+	static void destroyDrawTexture(ObsVideoTexture &texture);
+	static void drawObsTexture(const ObsVideoTexture &texture, const int boxWidth, const int boxHeight);
+	static void destroyGraphics();
 
 	bool popDataReadyForConnect(std::string &output);
 	bool popDataReadyForProduce(std::string &output);
@@ -46,8 +113,37 @@ public:
 	bool isProduceWaiting() const { return m_produceWaiting; }
 	bool isExpectingProduceFollowup() { return m_expectingProduceFollowup; }
 
-	static int getHardObsTextureWidth() { return 1280; }
-	static int getHardObsTextureHeight() { return 720; }
+	// Until the first frame arrives
+	static int getDefaultObsTextureWidth() { return 1280; }
+	static int getDefaultObsTextureHeight() { return 720; }
+
+	// A few times per keyframe retry, and longer than creating a consumer can wait on the connect round trip
+	static uint64_t getFirstFrameCheckNs() { return 100000000; }
+	static uint64_t getFirstFrameConsumerTimeoutNs() { return 40000000000; }
+
+	// The async variant has obs manage the frames, see mediasoupconnector_async
+	static bool isAsyncVideoSource(obs_source_t *source) { return source != nullptr && (obs_source_get_output_flags(source) & OBS_SOURCE_ASYNC) != 0; }
+
+	static void updateConsumerSinkWants(ObsSourceInfo &sourceInfo, const float seconds);
+	static void prepareConsumerView(ObsSourceInfo &sourceInfo);
+	static void requestFirstKeyFrame(ObsSourceInfo &sourceInfo);
+	static void reportConsumerDisplay(ObsSourceInfo &sourceInfo);
+	static void updateConsumerPauseState(ObsSourceInfo &sourceInfo);
+	static void signalConsumerPaused(const ObsSourceInfo &sourceInfo, const std::string &consumerId, const char *kind, const bool paused);
+	static bool getLargestOnCanvasSize(obs_source_t *source, int &width, int &height);
+
+	static int getSourceWidth(const ObsSourceInfo &sourceInfo);
+	static int getSourceHeight(const ObsSourceInfo &sourceInfo);
+
+	// Consumer registry, keyed by kind and producerId
+	bool attachToConsumer(ObsSourceInfo &sourceInfo, const std::string &producerId, const std::string &kind, std::string &output_consumerId);
+	void registerConsumer(ObsSourceInfo &sourceInfo, const std::string &producerId, const std::string &kind, const std::string &consumerId);
+	void detachSource(ObsSourceInfo &sourceInfo);
+	void forgetConsumer(const std::string &consumerId);
+	void forgetAllConsumers();
+	bool isConsumerRegistered(const std::string &consumerId);
+	bool isConsumerShown(const std::string &consumerId, const ObsSourceInfo &sourceInfo);
+	int getConsumerDisplayPixels(const std::string &consumerId, const ObsSourceInfo &sourceInfo);
 
 	MediaSoupTransceiver *getTransceiver() { return m_transceiver.get(); }
 
@@ -68,6 +164,15 @@ private:
 	std::unique_ptr<MediaSoupTransceiver> m_transceiver;
 	std::unique_ptr<std::thread> m_connectionThread;
 
+	std::mutex m_registryMtx;
+	std::map<std::string, SharedConsumer> m_consumerRegistry;
+
+	static std::string getRegistryKey(const std::string &producerId, const std::string &kind, obs_source_t *source);
+
+	static void uploadPlane(gs_texture_t *plane, const uint8_t *data, const int stride, const int width, const int height);
+	static gs_effect_t *getI420Effect();
+	static gs_effect_t *m_i420Effect;
+
 public:
 	static MediaSoupInterface &instance()
 	{
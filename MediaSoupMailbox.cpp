@@ -20,24 +20,25 @@ MediaSoupMailbox::~MediaSoupMailbox()
 		audio_resampler_destroy(m_to_mediasoup_resampler);
 }
 
-rtc::scoped_refptr<webrtc::I420Buffer> MediaSoupMailbox::getProducerFrameBuffer(const int width, const int height)
+void MediaSoupMailbox::push_received_videoFrame(const webrtc::VideoFrame &frame)
 {
-	if (m_producerFrameBuffer == nullptr || m_producerFrameBuffer->width() != width || m_producerFrameBuffer->height() != height)
-		m_producerFrameBuffer = webrtc::I420Buffer::Create(width, height);
-
-	return m_producerFrameBuffer;
+	// Assigning into an engaged slot only swaps the buffer ref, nothing is allocated
+	m_received_video_slots[m_received_video_back] = frame;
+	m_received_video_sequence[m_received_video_back] = ++m_received_video_counter;
+	m_received_video_back = m_received_video_middle.exchange(m_received_video_back | kReceivedVideoDirty, std::memory_order_acq_rel) & ~kReceivedVideoDirty;
 }
 
-void MediaSoupMailbox::push_received_videoFrame(std::unique_ptr<webrtc::VideoFrame> ptr)
+const webrtc::VideoFrame *MediaSoupMailbox::pop_received_videoFrame(uint64_t *sequence)
 {
-	std::lock_guard<std::mutex> grd(m_mtx_received_video);
-	m_received_video_frame = std::move(ptr);
-}
+	if ((m_received_video_middle.load(std::memory_order_acquire) & kReceivedVideoDirty) == 0)
+		return nullptr;
 
-void MediaSoupMailbox::pop_receieved_videoFrames(std::unique_ptr<webrtc::VideoFrame> &output)
-{
-	std::lock_guard<std::mutex> grd(m_mtx_received_video);
-	output = std::move(m_received_video_frame);
+	m_received_video_front = m_received_video_middle.exchange(m_received_video_front, std::memory_order_acq_rel) & ~kReceivedVideoDirty;
+
+	if (sequence != nullptr)
+		*sequence = m_received_video_sequence[m_received_video_front];
+
+	return &*m_received_video_slots[m_received_video_front];
 }
 
 void MediaSoupMailbox::assignOutgoingAudioParams(const audio_format audioformat, const speaker_layout speakerLayout, const int bytesPerSample,
@@ -2,6 +2,11 @@
 
 #include "MediaSoupTransceiver.h"
 
+#include "absl/types/optional.h"
+
+#include <array>
+#include <atomic>
+
 /**
 * MediaSoupMailbox
 */
@@ -20,12 +25,21 @@ public:
 public:
 	~MediaSoupMailbox();
 
-	rtc::scoped_refptr<webrtc::I420Buffer> getProducerFrameBuffer(const int width, const int height);
-
 public:
-	// Receive
-	void push_received_videoFrame(std::unique_ptr<webrtc::VideoFrame> ptr);
-	void pop_receieved_videoFrames(std::unique_ptr<webrtc::VideoFrame> &output);
+	// Receive, latest wins. One writer (the decode thread) and one reader (the render thread), neither ever blocks
+	void push_received_videoFrame(const webrtc::VideoFrame &frame);
+
+	// Null when nothing new arrived since the last pop, the frame stays valid until the next pop
+	const webrtc::VideoFrame *pop_received_videoFrame(uint64_t *sequence = nullptr);
+
+	// Decoded size before the sink scaled it down for display
+	void set_received_videoNativeSize(const int width, const int height) { m_received_video_native_size = (uint64_t(width) << 32) | uint32_t(height); }
+	void get_received_videoNativeSize(int &width, int &height) const
+	{
+		const uint64_t size = m_received_video_native_size;
+		width = int(size >> 32);
+		height = int(size & 0xFFFFFFFF);
+	}
 
 public:
 	// Outgoing
@@ -40,9 +54,16 @@ public:
 	void assignOutgoingVolume(const float vol) { m_volume = vol; }
 
 private:
-	// Receive
-	std::mutex m_mtx_received_video;
-	std::unique_ptr<webrtc::VideoFrame> m_received_video_frame;
+	// Receive, triple buffer. The writer owns the back slot, the reader owns the front slot, they trade through the middle index
+	static const int kReceivedVideoDirty = 4;
+
+	std::array<absl::optional<webrtc::VideoFrame>, 3> m_received_video_slots;
+	std::array<uint64_t, 3> m_received_video_sequence{};
+	std::atomic<int> m_received_video_middle{1};
+	int m_received_video_back = 0;
+	int m_received_video_front = 2;
+	uint64_t m_received_video_counter = 0;
+	std::atomic<uint64_t> m_received_video_native_size{0};
 
 private:
 	// Outgoing
@@ -65,6 +86,4 @@ private:
 	audio_resampler_t *m_to_float_resampler = nullptr;
 	audio_resampler_t *m_from_float_to_mediasoup_resampler = nullptr;
 	audio_resampler_t *m_to_mediasoup_resampler = nullptr;
-
-	rtc::scoped_refptr<webrtc::I420Buffer> m_producerFrameBuffer;
 };
@@ -0,0 +1,442 @@
+#ifndef _DEBUG
+
+#include "MediaSoupRecorder.h"
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include <algorithm>
+
+static void putLe16(std::vector<uint8_t> &dst, const uint16_t value)
+{
+	dst.push_back(uint8_t(value));
+	dst.push_back(uint8_t(value >> 8));
+}
+
+static void putLe32(std::vector<uint8_t> &dst, const uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		dst.push_back(uint8_t(value >> (i * 8)));
+}
+
+static void putLe64(std::vector<uint8_t> &dst, const uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		dst.push_back(uint8_t(value >> (i * 8)));
+}
+
+/**
+* MediaSoupRecorder
+*/
+
+MediaSoupRecorder::~MediaSoupRecorder()
+{
+	close();
+}
+
+bool MediaSoupRecorder::open(const std::string &path)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	// One file per recorder
+	if (m_open || m_stop)
+		return false;
+
+	m_file = os_fopen(path.c_str(), "wb");
+
+	if (m_file == nullptr) {
+		blog(LOG_WARNING, "MediaSoupRecorder::open - Unable to open '%s'", path.c_str());
+		return false;
+	}
+
+	m_path = path;
+	m_open = true;
+	m_thread = std::thread(&MediaSoupRecorder::writerThread, this);
+	return true;
+}
+
+// Everything queued is still written
+void MediaSoupRecorder::close()
+{
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+
+		if (m_open)
+			onClose();
+
+		m_open = false;
+		m_stop = true;
+	}
+
+	m_cv.notify_one();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool MediaSoupRecorder::isOpen()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	return m_open;
+}
+
+nlohmann::json MediaSoupRecorder::getStats()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	nlohmann::json output;
+	output["path"] = m_path;
+	output["recording"] = m_open;
+	output["frames"] = m_frames;
+	output["bytes"] = m_writtenBytes + m_queuedBytes;
+	output["failed"] = m_failed;
+	return output;
+}
+
+// Under m_mtx
+void MediaSoupRecorder::write(std::vector<uint8_t> data)
+{
+	if (!m_open || data.empty())
+		return;
+
+	if (m_queuedBytes + data.size() > kMaxQueuedBytes) {
+		blog(LOG_WARNING, "MediaSoupRecorder::write - '%s' is more than %zu bytes behind, stopping", m_path.c_str(), kMaxQueuedBytes);
+		m_failed = true;
+		m_open = false;
+		return;
+	}
+
+	m_queuedBytes += data.size();
+	m_queue.push_back(std::move(data));
+	m_cv.notify_one();
+}
+
+// Under m_mtx
+void MediaSoupRecorder::writeHeaderOnClose(std::vector<uint8_t> data)
+{
+	m_header = std::move(data);
+}
+
+void MediaSoupRecorder::writerThread()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+
+	while (true) {
+		m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+
+		if (m_queue.empty())
+			break;
+
+		std::vector<uint8_t> data = std::move(m_queue.front());
+		m_queue.pop_front();
+
+		lock.unlock();
+		const bool written = m_failed || fwrite(data.data(), 1, data.size(), m_file) == data.size();
+		lock.lock();
+
+		m_queuedBytes -= data.size();
+
+		if (!written) {
+			blog(LOG_WARNING, "MediaSoupRecorder::writerThread - Write to '%s' failed, stopping", m_path.c_str());
+			m_failed = true;
+			m_open = false;
+		} else if (!m_failed) {
+			m_writtenBytes += data.size();
+		}
+	}
+
+	if (!m_header.empty() && fseek(m_file, 0, SEEK_SET) == 0)
+		fwrite(m_header.data(), 1, m_header.size(), m_file);
+
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+/**
+* MediaSoupIvfRecorder
+*/
+
+void MediaSoupIvfRecorder::OnFrame(const webrtc::RecordableEncodedFrame &frame)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	// Starts on a keyframe, adding the encoded sink asks for one
+	if (m_firstRenderMs < 0) {
+		if (!frame.is_key_frame())
+			return;
+
+		if (!getFourcc(frame.codec(), m_fourcc)) {
+			blog(LOG_WARNING, "MediaSoupIvfRecorder::OnFrame - Codec %d can't go in an ivf file", int(frame.codec()));
+			return;
+		}
+
+		m_width = int(frame.resolution().width);
+		m_height = int(frame.resolution().height);
+		m_firstRenderMs = frame.render_time().ms();
+		write(makeHeader());
+	}
+
+	rtc::scoped_refptr<const webrtc::EncodedImageBufferInterface> buffer = frame.encoded_buffer();
+
+	if (buffer == nullptr || buffer->size() == 0)
+		return;
+
+	// Millisecond timebase, kept increasing if webrtc's render times jump back
+	const int64_t pts = std::max(m_lastPts + 1, frame.render_time().ms() - m_firstRenderMs);
+	m_lastPts = pts;
+
+	std::vector<uint8_t> data;
+	data.reserve(12 + buffer->size());
+	putLe32(data, uint32_t(buffer->size()));
+	putLe64(data, uint64_t(pts));
+	data.insert(data.end(), buffer->data(), buffer->data() + buffer->size());
+	write(std::move(data));
+
+	++m_frames;
+}
+
+// The frame count is only known now
+void MediaSoupIvfRecorder::onClose()
+{
+	if (m_firstRenderMs >= 0)
+		writeHeaderOnClose(makeHeader());
+}
+
+bool MediaSoupIvfRecorder::getFourcc(const webrtc::VideoCodecType codec, uint32_t &output)
+{
+	const char *fourcc = nullptr;
+
+	switch (codec) {
+	case webrtc::kVideoCodecVP8:
+		fourcc = "VP80";
+		break;
+	case webrtc::kVideoCodecVP9:
+		fourcc = "VP90";
+		break;
+	case webrtc::kVideoCodecAV1:
+		fourcc = "AV01";
+		break;
+	case webrtc::kVideoCodecH264:
+		fourcc = "H264";
+		break;
+	default:
+		return false;
+	}
+
+	output = uint32_t(fourcc[0]) | (uint32_t(fourcc[1]) << 8) | (uint32_t(fourcc[2]) << 16) | (uint32_t(fourcc[3]) << 24);
+	return true;
+}
+
+std::vector<uint8_t> MediaSoupIvfRecorder::makeHeader() const
+{
+	std::vector<uint8_t> header = {'D', 'K', 'I', 'F'};
+	putLe16(header, 0);
+	putLe16(header, 32);
+	putLe32(header, m_fourcc);
+	putLe16(header, uint16_t(m_width));
+	putLe16(header, uint16_t(m_height));
+	putLe32(header, 1000);
+	putLe32(header, 1);
+	putLe32(header, uint32_t(m_frames));
+	putLe32(header, 0);
+	return header;
+}
+
+/**
+* MediaSoupOggOpusRecorder
+*/
+
+MediaSoupOggOpusRecorder::MediaSoupOggOpusRecorder() : m_serial(uint32_t(os_gettime_ns())) {}
+
+void MediaSoupOggOpusRecorder::push(const uint8_t *data, const size_t size, const uint32_t rtpTimestamp)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	const int samples = getPacketSamples(data, size);
+
+	// 255 lacing values per page, far more than an opus packet needs
+	if (samples <= 0 || size > 255 * 255 - 1)
+		return;
+
+	if (!m_started) {
+		// RFC 7845, stereo since the decoder's output follows each packet's own stereo flag
+		std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2};
+		putLe16(head, 0);
+		putLe32(head, 48000);
+		putLe16(head, 0);
+		head.push_back(0);
+		writePage(head.data(), head.size(), 0, 0x02);
+
+		static const char vendor[] = "mediasoup-connector";
+		std::vector<uint8_t> tags = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+		putLe32(tags, uint32_t(sizeof(vendor) - 1));
+		tags.insert(tags.end(), vendor, vendor + sizeof(vendor) - 1);
+		putLe32(tags, 0);
+		writePage(tags.data(), tags.size(), 0, 0);
+
+		m_firstTimestamp = rtpTimestamp;
+		m_lastTimestamp = rtpTimestamp;
+		m_started = true;
+	}
+
+	// Late or repeated packets would put the granule positions out of order
+	if (m_hasPending && int32_t(rtpTimestamp - m_lastTimestamp) <= 0)
+		return;
+
+	if (m_hasPending)
+		writePage(m_pending.data(), m_pending.size(), m_pendingGranule, 0);
+
+	m_pending.assign(data, data + size);
+	m_pendingGranule = uint64_t(uint32_t(rtpTimestamp - m_firstTimestamp)) + uint64_t(samples);
+	m_lastTimestamp = rtpTimestamp;
+	m_hasPending = true;
+	++m_frames;
+}
+
+void MediaSoupOggOpusRecorder::onClose()
+{
+	if (m_hasPending)
+		writePage(m_pending.data(), m_pending.size(), m_pendingGranule, 0x04);
+
+	m_hasPending = false;
+}
+
+// RFC 6716 section 3.1, the toc byte gives the frame duration and the code how many frames follow
+int MediaSoupOggOpusRecorder::getPacketSamples(const uint8_t *data, const size_t size)
+{
+	if (data == nullptr || size == 0)
+		return 0;
+
+	const int config = data[0] >> 3;
+	int frameSamples = 0;
+
+	if (config < 12)
+		frameSamples = 480 << (config & 3); // silk, 10/20/40/60 ms
+	else if (config < 16)
+		frameSamples = 480 << (config & 1); // hybrid, 10/20 ms
+	else
+		frameSamples = 120 << (config & 3); // celt, 2.5/5/10/20 ms
+
+	int frames = 1;
+
+	switch (data[0] & 3) {
+	case 1:
+	case 2:
+		frames = 2;
+		break;
+	case 3:
+		if (size < 2)
+			return 0;
+
+		frames = data[1] & 0x3f;
+		break;
+	}
+
+	return frames * frameSamples;
+}
+
+// Under m_mtx, one packet per page
+void MediaSoupOggOpusRecorder::writePage(const uint8_t *data, const size_t size, const uint64_t granule, const uint8_t flags)
+{
+	std::vector<uint8_t> page = {'O', 'g', 'g', 'S', 0, flags};
+	putLe64(page, granule);
+	putLe32(page, m_serial);
+	putLe32(page, m_pageSequence++);
+	putLe32(page, 0);
+
+	const size_t segments = size / 255 + 1;
+	page.push_back(uint8_t(segments));
+
+	for (size_t i = 0; i + 1 < segments; ++i)
+		page.push_back(255);
+
+	page.push_back(uint8_t(size % 255));
+	page.insert(page.end(), data, data + size);
+
+	const uint32_t crc = crc32(page.data(), page.size());
+
+	for (int i = 0; i < 4; ++i)
+		page[22 + i] = uint8_t(crc >> (i * 8));
+
+	write(std::move(page));
+}
+
+// Ogg's crc, polynomial 0x04c11db7 without any reflection
+uint32_t MediaSoupOggOpusRecorder::crc32(const uint8_t *data, const size_t size)
+{
+	static const std::vector<uint32_t> table = [] {
+		std::vector<uint32_t> output(256);
+
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t value = i << 24;
+
+			for (int bit = 0; bit < 8; ++bit)
+				value = (value & 0x80000000) ? (value << 1) ^ 0x04c11db7 : (value << 1);
+
+			output[i] = value;
+		}
+
+		return output;
+	}();
+
+	uint32_t crc = 0;
+
+	for (size_t i = 0; i < size; ++i)
+		crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+
+	return crc;
+}
+
+/**
+* MediaSoupOpusTap
+*/
+
+void MediaSoupOpusTap::setRecorder(std::shared_ptr<MediaSoupOggOpusRecorder> recorder)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_recorder = recorder;
+}
+
+void MediaSoupOpusTap::Transform(std::unique_ptr<webrtc::TransformableFrameInterface> frame)
+{
+	std::shared_ptr<MediaSoupOggOpusRecorder> recorder;
+	rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback;
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+		recorder = m_recorder;
+		callback = m_callback;
+	}
+
+	if (recorder != nullptr) {
+		rtc::ArrayView<const uint8_t> data = frame->GetData();
+		recorder->push(data.data(), data.size(), frame->GetTimestamp());
+	}
+
+	if (callback != nullptr)
+		callback->OnTransformedFrame(std::move(frame));
+}
+
+void MediaSoupOpusTap::RegisterTransformedFrameCallback(rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_callback = callback;
+}
+
+void MediaSoupOpusTap::RegisterTransformedFrameSinkCallback(rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback, uint32_t ssrc)
+{
+	RegisterTransformedFrameCallback(callback);
+}
+
+void MediaSoupOpusTap::UnregisterTransformedFrameCallback()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_callback = nullptr;
+}
+
+void MediaSoupOpusTap::UnregisterTransformedFrameSinkCallback(uint32_t ssrc)
+{
+	UnregisterTransformedFrameCallback();
+}
+
+#endif
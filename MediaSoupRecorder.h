@@ -0,0 +1,128 @@
+#pragma once
+
+#include "api/frame_transformer_interface.h"
+#include "api/video/recordable_encoded_frame.h"
+
+#include <json.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+* MediaSoupRecorder
+*/
+
+// Writes a consumer's payloads to disk as they arrive, nothing is decoded or encoded again
+// Callers are webrtc's receive threads, so the file itself is only touched from a writer thread
+class MediaSoupRecorder {
+public:
+	virtual ~MediaSoupRecorder();
+
+	bool open(const std::string &path);
+	void close();
+
+	// False once closed or stopped because the disk couldn't keep up
+	bool isOpen();
+
+	nlohmann::json getStats();
+
+protected:
+	void write(std::vector<uint8_t> data);
+
+	// Written over the start of the file once everything else is flushed
+	void writeHeaderOnClose(std::vector<uint8_t> data);
+
+	// Whatever the container needs to finish, called before the writer drains
+	virtual void onClose() {}
+
+	// The frames it's already written, under m_mtx
+	uint64_t m_frames = 0;
+
+	std::mutex m_mtx;
+
+private:
+	void writerThread();
+
+	// Past this the disk isn't keeping up, the recording stops rather than growing without bound
+	static const size_t kMaxQueuedBytes = 64 * 1024 * 1024;
+
+	std::condition_variable m_cv;
+	std::deque<std::vector<uint8_t>> m_queue;
+	std::vector<uint8_t> m_header;
+	std::thread m_thread;
+	std::string m_path;
+	FILE *m_file{nullptr};
+	size_t m_queuedBytes = 0;
+	uint64_t m_writtenBytes = 0;
+	bool m_open{false};
+	bool m_stop{false};
+	bool m_failed{false};
+};
+
+// VP8, VP9, AV1 and H.264 (annex b) from the track source's encoded output
+class MediaSoupIvfRecorder : public MediaSoupRecorder, public rtc::VideoSinkInterface<webrtc::RecordableEncodedFrame> {
+public:
+	void OnFrame(const webrtc::RecordableEncodedFrame &frame) override;
+
+private:
+	void onClose() override;
+
+	static bool getFourcc(const webrtc::VideoCodecType codec, uint32_t &output);
+	std::vector<uint8_t> makeHeader() const;
+
+	uint32_t m_fourcc = 0;
+	int m_width = 0;
+	int m_height = 0;
+	int64_t m_firstRenderMs = -1;
+	int64_t m_lastPts = -1;
+};
+
+// Ogg Opus, granule positions come from the rtp timestamps which are always 48 kHz for opus
+class MediaSoupOggOpusRecorder : public MediaSoupRecorder {
+public:
+	MediaSoupOggOpusRecorder();
+
+	void push(const uint8_t *data, const size_t size, const uint32_t rtpTimestamp);
+
+	static int getPacketSamples(const uint8_t *data, const size_t size);
+
+private:
+	void onClose() override;
+
+	void writePage(const uint8_t *data, const size_t size, const uint64_t granule, const uint8_t flags);
+	static uint32_t crc32(const uint8_t *data, const size_t size);
+
+	// Held back one packet, the last one is written with the end of stream flag
+	std::vector<uint8_t> m_pending;
+	uint64_t m_pendingGranule = 0;
+	bool m_hasPending{false};
+
+	uint32_t m_serial = 0;
+	uint32_t m_pageSequence = 0;
+	uint32_t m_firstTimestamp = 0;
+	uint32_t m_lastTimestamp = 0;
+	bool m_started{false};
+};
+
+// Installed on an audio receiver between depacketizer and decoder, every frame passes through untouched
+// Webrtc can't take it back out, so it stays for the consumer's lifetime and is just pointed at a recorder or not
+class MediaSoupOpusTap : public webrtc::FrameTransformerInterface {
+public:
+	void setRecorder(std::shared_ptr<MediaSoupOggOpusRecorder> recorder);
+
+	void Transform(std::unique_ptr<webrtc::TransformableFrameInterface> frame) override;
+	void RegisterTransformedFrameCallback(rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback) override;
+	void RegisterTransformedFrameSinkCallback(rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback, uint32_t ssrc) override;
+	void UnregisterTransformedFrameCallback() override;
+	void UnregisterTransformedFrameSinkCallback(uint32_t ssrc) override;
+
+private:
+	std::mutex m_mtx;
+	std::shared_ptr<MediaSoupOggOpusRecorder> m_recorder;
+	rtc::scoped_refptr<webrtc::TransformedFrameCallback> m_callback;
+};
@@ -0,0 +1,58 @@
+#ifndef _DEBUG
+
+#include "MediaSoupSyncEngine.h"
+
+#include "rtc_base/time_utils.h"
+
+#include <util/platform.h>
+
+#include <algorithm>
+
+/**
+* MediaSoupSyncEngine
+*/
+
+MediaSoupSyncEngine::MediaSoupSyncEngine() : m_delayNs(uint64_t(getDefaultPresentationDelayMs()) * 1000000)
+{
+	m_clockOffsetNs = int64_t(os_gettime_ns()) - rtc::TimeNanos();
+}
+
+void MediaSoupSyncEngine::setPresentationDelayMs(const int delayMs)
+{
+	m_delayNs = uint64_t(std::max(0, std::min(delayMs, 1000))) * 1000000;
+}
+
+// Audio is pulled at its playout time, so now is when webrtc meant it to be heard
+uint64_t MediaSoupSyncEngine::getAudioPresentationTime(AudioClock &clock, const size_t frames, const uint32_t sampleRate, const int cutMs)
+{
+	const uint64_t delayNs = m_delayNs;
+	const uint64_t now = os_gettime_ns() + delayNs - std::min(delayNs, uint64_t(std::max(cutMs, 0)) * 1000000);
+	const uint64_t drift = clock.m_next > now ? clock.m_next - now : now - clock.m_next;
+
+	if (clock.m_next == 0 || drift > getAudioResyncThresholdNs())
+		clock.m_next = now;
+
+	const uint64_t output = clock.m_next;
+	clock.m_next += uint64_t(frames) * 1000000000 / std::max(sampleRate, uint32_t(1));
+	return output;
+}
+
+// render_time_ms is webrtc's own target, already adjusted for the audio it is synced with
+// 0 means show as soon as possible
+uint64_t MediaSoupSyncEngine::getVideoPresentationTime(const int64_t renderTimeMs)
+{
+	const uint64_t now = os_gettime_ns();
+
+	if (renderTimeMs <= 0)
+		return now + m_delayNs;
+
+	const int64_t renderTime = renderTimeMs * 1000000 + m_clockOffsetNs;
+
+	// Nonsense from a clock jump, don't hold the frame back for it
+	if (renderTime <= 0 || uint64_t(renderTime) > now + 1000000000)
+		return now + m_delayNs;
+
+	return uint64_t(renderTime) + m_delayNs;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "api/video/video_frame.h"
+
+#include <obs-module.h>
+#include <atomic>
+
+/**
+* MediaSoupSyncEngine
+*/
+
+// Puts consumer audio and video on the obs clock with one common presentation delay
+// Webrtc already lines up a participant's audio playout with its video render times, so both are stamped from those rather than from arrival
+class MediaSoupSyncEngine {
+public:
+	// Per audio output, keeps consecutive blocks back to back instead of stamping each from the thread's wakeup
+	struct AudioClock {
+		uint64_t m_next = 0;
+	};
+
+	// cutMs comes off the presentation delay for this one output, see MediaSoupTransceiver::EnforceJitterTarget
+	uint64_t getAudioPresentationTime(AudioClock &clock, const size_t frames, const uint32_t sampleRate, const int cutMs = 0);
+	uint64_t getVideoPresentationTime(const webrtc::VideoFrame &frame) { return getVideoPresentationTime(frame.render_time_ms()); }
+	uint64_t getVideoPresentationTime(const int64_t renderTimeMs);
+
+	void setPresentationDelayMs(const int delayMs);
+	int getPresentationDelayMs() const { return int(m_delayNs / 1000000); }
+
+	static MediaSoupSyncEngine &instance()
+	{
+		static MediaSoupSyncEngine s;
+		return s;
+	}
+
+	// Enough to absorb the render tick landing anywhere within a video frame
+	static int getDefaultPresentationDelayMs() { return 20; }
+
+	// Audio drifting further than this from the wall clock is resynced
+	static uint64_t getAudioResyncThresholdNs() { return 40000000; }
+
+private:
+	MediaSoupSyncEngine();
+
+	// os_gettime_ns() - rtc::TimeNanos(), both are monotonic so it's taken once
+	int64_t m_clockOffsetNs = 0;
+	std::atomic<uint64_t> m_delayNs;
+};
@@ -3,7 +3,12 @@
 #include "MediaSoupTransceiver.h"
 #include "MyFrameGeneratorInterface.h"
 #include "MyProducerAudioDeviceModule.h"
+#include "MyConsumerAudioDeviceModule.h"
+#include "MyAudioDeviceModule.h"
+#include "MyConsumerAudioMixer.h"
+#include "MyPassthroughVideoEncoder.h"
 #include "MediaSoupMailbox.h"
+#include "MediaSoupAudioMixer.h"
 #include "ConnectorFrontApi.h"
 
 #include "api/create_peerconnection_factory.h"
@@ -15,7 +20,24 @@
 #include "modules/audio_device/audio_device_impl.h"
 #include "modules/audio_device/audio_device_buffer.h"
 #include "common_audio/include/audio_util.h"
+#include "common_audio/resampler/push_sinc_resampler.h"
 #include "rtc_base/random.h"
+#include "rtc_base/time_utils.h"
+
+#include <third_party/libyuv/include/libyuv.h>
+#include <media-io/video-io.h>
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MSOUP_SINK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MSOUP_SINK_NEON
+#endif
 
 #ifdef _WIN32
 #pragma comment(lib, "Secur32.lib")
@@ -37,7 +59,10 @@ MediaSoupTransceiver::~MediaSoupTransceiver()
 	Stop();
 }
 
-bool MediaSoupTransceiver::LoadDevice(json &routerRtpCapabilities, json &output_deviceRtpCapabilities, json &output_deviceSctpCapabilities)
+// A shared factory runs both transports on one thread set, three threads instead of six and one set of codec factories
+// Capabilities come from a throwaway factory on a single thread, the real factories warm up in the background until a transport needs them
+bool MediaSoupTransceiver::LoadDevice(json &routerRtpCapabilities, json &output_deviceRtpCapabilities, json &output_deviceSctpCapabilities,
+				      const bool sharedFactory /*= false*/)
 {
 	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
 
@@ -46,23 +71,34 @@ bool MediaSoupTransceiver::LoadDevice(json &routerRtpCapabilities, json &output_
 		return false;
 	}
 
+	const uint64_t startNs = os_gettime_ns();
+
+	for (auto *timing : {&m_loadDeviceMs, &m_probeFactoryMs, &m_deviceLoadMs, &m_producerFactoryMs, &m_consumerFactoryMs, &m_producerFactoryWaitMs,
+			     &m_consumerFactoryWaitMs})
+		*timing = -1;
+
 	m_device = std::make_unique<mediasoupclient::Device>();
+	m_sharedFactory = sharedFactory;
+	StartFactoryWarmup();
 
 	try {
-		m_factory_Producer = CreateProducerFactory();
+		std::unique_ptr<rtc::Thread> probeThread;
+		rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> probeFactory = CreateProbeFactory(probeThread);
 
-		if (m_factory_Producer == nullptr)
+		if (probeFactory == nullptr) {
+			m_lastErorMsg = "Unable to create the capabilities factory";
 			return false;
+		}
 
-		m_factory_Consumer = CreateConsumerFactory();
+		m_probeFactoryMs = getElapsedMs(startNs);
 
-		if (m_factory_Consumer == nullptr)
-			return false;
+		mediasoupclient::PeerConnection::Options probeOptions;
+		probeOptions.factory = probeFactory.get();
 
+		const uint64_t loadNs = os_gettime_ns();
 		m_id = std::to_string(rtc::CreateRandomId());
-		m_consumerOptions.factory = m_factory_Consumer.get();
-		m_producerOptions.factory = m_factory_Producer.get();
-		m_device->Load(routerRtpCapabilities, &m_producerOptions);
+		m_device->Load(routerRtpCapabilities, &probeOptions);
+		m_deviceLoadMs = getElapsedMs(loadNs);
 
 		output_deviceRtpCapabilities = m_device->GetRtpCapabilities();
 		output_deviceSctpCapabilities = m_device->GetSctpCapabilities();
@@ -71,10 +107,124 @@ bool MediaSoupTransceiver::LoadDevice(json &routerRtpCapabilities, json &output_
 		return false;
 	}
 
+	m_loadDeviceMs = getElapsedMs(startNs);
+	return true;
+}
+
+// Same codecs as the real factories, the temporary peer connection Device::Load makes only needs them to write an offer
+rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> MediaSoupTransceiver::CreateProbeFactory(std::unique_ptr<rtc::Thread> &thread)
+{
+	thread = rtc::Thread::CreateWithSocketServer();
+	thread->SetName("MSTprobe_thread", nullptr);
+
+	if (!thread->Start()) {
+		blog(LOG_ERROR, "MediaSoupTransceiver::CreateProbeFactory - webrtc thread start errored");
+		return nullptr;
+	}
+
+	rtc::scoped_refptr<webrtc::AudioDeviceModule> adm = new rtc::RefCountedObject<MyConsumerAudioDeviceModule>{};
+
+	return webrtc::CreatePeerConnectionFactory(thread.get(), thread.get(), thread.get(), adm, webrtc::CreateBuiltinAudioEncoderFactory(),
+						   webrtc::CreateBuiltinAudioDecoderFactory(), webrtc::CreateBuiltinVideoEncoderFactory(),
+						   webrtc::CreateBuiltinVideoDecoderFactory(), new rtc::RefCountedObject<MyConsumerAudioMixer>{},
+						   nullptr /*audio_processing*/);
+}
+
+// Each on its own thread, they only touch their own members
+void MediaSoupTransceiver::StartFactoryWarmup()
+{
+	const bool sharedFactory = m_sharedFactory;
+
+	m_producerFactoryWarmup = std::async(std::launch::async, [this, sharedFactory]() {
+		const uint64_t startNs = os_gettime_ns();
+		auto factory = CreateProducerFactory(sharedFactory);
+		m_producerFactoryMs = getElapsedMs(startNs);
+		return factory;
+	});
+
+	if (sharedFactory)
+		return;
+
+	m_consumerFactoryWarmup = std::async(std::launch::async, [this]() {
+		const uint64_t startNs = os_gettime_ns();
+		auto factory = CreateConsumerFactory();
+		m_consumerFactoryMs = getElapsedMs(startNs);
+		return factory;
+	});
+}
+
+// Under m_transportMutex, waits for the warm up if it isn't done yet
+bool MediaSoupTransceiver::EnsureProducerFactory()
+{
+	if (m_factory_Producer != nullptr)
+		return true;
+
+	if (!m_producerFactoryWarmup.valid()) {
+		m_lastErorMsg = "Factory not available";
+		return false;
+	}
+
+	const uint64_t startNs = os_gettime_ns();
+	m_factory_Producer = m_producerFactoryWarmup.get();
+	m_producerFactoryWaitMs = getElapsedMs(startNs);
+
+	if (m_factory_Producer == nullptr) {
+		m_lastErorMsg = "Unable to create the producer factory";
+		return false;
+	}
+
+	m_producerOptions.factory = m_factory_Producer.get();
+	return true;
+}
+
+bool MediaSoupTransceiver::EnsureConsumerFactory()
+{
+	if (m_factory_Consumer != nullptr)
+		return true;
+
+	if (m_sharedFactory) {
+		if (!EnsureProducerFactory())
+			return false;
+
+		m_factory_Consumer = m_factory_Producer;
+		m_consumerOptions.factory = m_factory_Consumer.get();
+		return true;
+	}
+
+	if (!m_consumerFactoryWarmup.valid()) {
+		m_lastErorMsg = "Factory not available";
+		return false;
+	}
+
+	const uint64_t startNs = os_gettime_ns();
+	m_factory_Consumer = m_consumerFactoryWarmup.get();
+	m_consumerFactoryWaitMs = getElapsedMs(startNs);
+
+	if (m_factory_Consumer == nullptr) {
+		m_lastErorMsg = "Unable to create the consumer factory";
+		return false;
+	}
+
+	m_consumerOptions.factory = m_factory_Consumer.get();
 	return true;
 }
 
-rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> MediaSoupTransceiver::CreateProducerFactory()
+// -1 for whatever hasn't happened yet, the factory times are how long each took to build and the waits how long a transport was held up by it
+json MediaSoupTransceiver::GetLoadTimings()
+{
+	json output;
+	output["loadDeviceMs"] = m_loadDeviceMs.load();
+	output["probeFactoryMs"] = m_probeFactoryMs.load();
+	output["deviceLoadMs"] = m_deviceLoadMs.load();
+	output["producerFactoryMs"] = m_producerFactoryMs.load();
+	output["consumerFactoryMs"] = m_consumerFactoryMs.load();
+	output["producerFactoryWaitMs"] = m_producerFactoryWaitMs.load();
+	output["consumerFactoryWaitMs"] = m_consumerFactoryWaitMs.load();
+	output["sharedFactory"] = m_sharedFactory;
+	return output;
+}
+
+rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> MediaSoupTransceiver::CreateProducerFactory(const bool sharedFactory)
 {
 	m_networkThread_Producer = rtc::Thread::CreateWithSocketServer();
 	m_signalingThread_Producer = rtc::Thread::Create();
@@ -89,12 +239,24 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> MediaSoupTransceiver:
 		return nullptr;
 	}
 
-	m_MyProducerAudioDeviceModule = new rtc::RefCountedObject<MyProducerAudioDeviceModule>{};
+	// Shared, the consumers' playout pull comes along in the same device
+	if (sharedFactory)
+		m_MyProducerAudioDeviceModule = new rtc::RefCountedObject<MyAudioDeviceModule>{};
+	else
+		m_MyProducerAudioDeviceModule = new rtc::RefCountedObject<MyProducerAudioDeviceModule>{};
+
+	m_passthroughTap = std::make_shared<MyObsEncoderTap>();
+
+	// Shared, the playout pull serves the consumers too and only has to reach their sinks
+	rtc::scoped_refptr<webrtc::AudioMixer> audioMixer;
+
+	if (sharedFactory)
+		audioMixer = new rtc::RefCountedObject<MyConsumerAudioMixer>{};
 
 	auto factory = webrtc::CreatePeerConnectionFactory(m_networkThread_Producer.get(), m_workerThread_Producer.get(), m_signalingThread_Producer.get(),
 							   m_MyProducerAudioDeviceModule, webrtc::CreateBuiltinAudioEncoderFactory(),
-							   webrtc::CreateBuiltinAudioDecoderFactory(), webrtc::CreateBuiltinVideoEncoderFactory(),
-							   webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /*audio_mixer*/, nullptr /*audio_processing*/);
+							   webrtc::CreateBuiltinAudioDecoderFactory(), std::make_unique<MyPassthroughVideoEncoderFactory>(m_passthroughTap),
+							   webrtc::CreateBuiltinVideoDecoderFactory(), audioMixer, nullptr /*audio_processing*/);
 
 	if (!factory) {
 		blog(LOG_ERROR, "MediaSoupTransceiver::CreateProducerFactory - webrtc error ocurred creating peerconnection factory");
@@ -119,17 +281,14 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> MediaSoupTransceiver:
 		return nullptr;
 	}
 
-	std::thread thr([&]() {
-		m_DefaultDeviceCore_TaskQueue = webrtc::CreateDefaultTaskQueueFactory();
-		m_DefaultDeviceCore = webrtc::AudioDeviceModule::Create(webrtc::AudioDeviceModule::kPlatformDefaultAudio, m_DefaultDeviceCore_TaskQueue.get());
-	});
-
-	thr.join();
+	// Nothing is played out locally, the consumers' audio goes to obs through their sinks and the mixer never sums it
+	m_MyConsumerAudioDeviceModule = new rtc::RefCountedObject<MyConsumerAudioDeviceModule>{};
 
 	auto factory = webrtc::CreatePeerConnectionFactory(m_networkThread_Consumer.get(), m_workerThread_Consumer.get(), m_signalingThread_Consumer.get(),
-							   m_DefaultDeviceCore, webrtc::CreateBuiltinAudioEncoderFactory(),
+							   m_MyConsumerAudioDeviceModule, webrtc::CreateBuiltinAudioEncoderFactory(),
 							   webrtc::CreateBuiltinAudioDecoderFactory(), webrtc::CreateBuiltinVideoEncoderFactory(),
-							   webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /*audio_mixer*/, nullptr /*audio_processing*/);
+							   webrtc::CreateBuiltinVideoDecoderFactory(), new rtc::RefCountedObject<MyConsumerAudioMixer>{},
+							   nullptr /*audio_processing*/);
 
 	if (!factory) {
 		blog(LOG_ERROR, "MediaSoupTransceiver::CreateFactory - webrtc error ocurred creating peerconnection factory");
@@ -154,6 +313,9 @@ bool MediaSoupTransceiver::CreateReceiver(const std::string &recvTransportId, co
 		return false;
 	}
 
+	if (!EnsureConsumerFactory())
+		return false;
+
 	try {
 		m_consumerOptions.config.servers.clear();
 
@@ -203,95 +365,1209 @@ bool MediaSoupTransceiver::CreateSender(const std::string &id, const json &icePa
 		return false;
 	}
 
-	try {
-		m_producerOptions.config.servers.clear();
+	if (!EnsureProducerFactory())
+		return false;
+
+	try {
+		m_producerOptions.config.servers.clear();
+
+		if (iceServers != nullptr) {
+			blog(LOG_DEBUG, "MediaSoupTransceiver::CreateSender - Using iceServers %s", iceServers->dump().c_str());
+
+			for (const auto &iceServerUri : *iceServers) {
+				webrtc::PeerConnectionInterface::IceServer iceServer;
+				iceServer.username = iceServerUri["username"].get<std::string>();
+				iceServer.password = iceServerUri["credential"].get<std::string>();
+				iceServer.urls = iceServerUri["urls"].get<std::vector<std::string>>();
+				m_producerOptions.config.servers.push_back(iceServer);
+			}
+		} else {
+			blog(LOG_DEBUG, "MediaSoupTransceiver::CreateSender - Not using iceServers");
+		}
+
+		m_sendTransport = m_device->CreateSendTransport(this, id, iceParameters, iceCandidates, dtlsParameters, &m_producerOptions);
+	} catch (...) {
+		m_lastErorMsg = "Unable to create the send transport";
+		return false;
+	}
+
+	return true;
+}
+
+bool MediaSoupTransceiver::CreateVideoProducerTrack(const std::string &id, const nlohmann::json *ecodings /*= nullptr*/,
+						    const nlohmann::json *codecOptions /*= nullptr*/, const nlohmann::json *codec /*= nullptr*/,
+						    const std::string &passthroughEncoder /*= ""*/, const std::string &contentHint /*= ""*/)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
+
+	if (m_device == nullptr) {
+		m_lastErorMsg = "Device not created";
+		return false;
+	}
+
+	if (m_factory_Producer == nullptr) {
+		m_lastErorMsg = "Factory not yet created";
+		return false;
+	}
+
+	if (m_sendTransport == nullptr) {
+		m_lastErorMsg = "Transport not created";
+		return false;
+	}
+
+	if (m_device->CanProduce("video")) {
+		json passthroughCodec;
+
+		if (!passthroughEncoder.empty()) {
+			if (!StartPassthrough(passthroughEncoder, passthroughCodec))
+				return false;
+
+			// The obs bitstream is a single layer h264 stream
+			ecodings = nullptr;
+			codec = passthroughCodec.empty() ? codec : &passthroughCodec;
+		}
+
+		auto mailbox = std::make_shared<MediaSoupMailbox>();
+		webrtc::VideoTrackInterface::ContentHint hint = ToContentHint(contentHint);
+		bool isScreencast = hint == webrtc::VideoTrackInterface::ContentHint::kDetailed || hint == webrtc::VideoTrackInterface::ContentHint::kText;
+
+		auto videoTrack = CreateProducerVideoTrack(m_factory_Producer, std::to_string(rtc::CreateRandomId()), mailbox, isScreencast);
+		videoTrack->set_content_hint(hint);
+
+		std::vector<webrtc::RtpEncodingParameters> encodings;
+
+		std::string defaultScalabilityMode = passthroughEncoder.empty() ? GetDefaultScalabilityMode(codec) : "";
+
+		if (ecodings != nullptr) {
+			for (auto &itr : *ecodings) {
+				webrtc::RtpEncodingParameters option;
+
+				if (itr.contains("maxBitrate"))
+					option.max_bitrate_bps = itr["maxBitrate"].get<int>();
+
+				if (itr.contains("scaleResolutionDownBy"))
+					option.scale_resolution_down_by = itr["scaleResolutionDownBy"].get<double>();
+
+				if (itr.contains("scalabilityMode"))
+					option.scalability_mode = itr["scalabilityMode"].get<std::string>();
+
+				encodings.emplace_back(option);
+			}
+		} else if (!passthroughEncoder.empty()) {
+			encodings.emplace_back(webrtc::RtpEncodingParameters{});
+		} else if (!defaultScalabilityMode.empty()) {
+			// One SVC encoder instead of three simulcast encoders
+			webrtc::RtpEncodingParameters option;
+			option.scalability_mode = defaultScalabilityMode;
+			encodings.emplace_back(option);
+		} else {
+			encodings.emplace_back(webrtc::RtpEncodingParameters{});
+			encodings.emplace_back(webrtc::RtpEncodingParameters{});
+			encodings.emplace_back(webrtc::RtpEncodingParameters{});
+		}
+
+		// libmediasoupclient does not carry scalabilityMode into the rtpParameters, OnProduce puts it back for the router
+		m_pendingScalabilityModes.clear();
+
+		for (auto &itr : encodings)
+			m_pendingScalabilityModes.push_back(itr.scalability_mode.value_or(""));
+
+		auto ptr = m_sendTransport->Produce(this, videoTrack, &encodings, codecOptions, codec);
+		m_pendingScalabilityModes.clear();
+
+		if (ptr != nullptr) {
+			AssignProducer(id, ptr, mailbox);
+
+			if (!passthroughEncoder.empty())
+				m_passthroughProducer = id;
+		} else {
+			if (!passthroughEncoder.empty())
+				m_passthroughTap->Stop();
+
+			m_lastErorMsg = "MediaSoupTransceiver::CreateVideoProducerTrack - Transport failed to produce video";
+			return false;
+		}
+	} else {
+		m_lastErorMsg = "MediaSoupTransceiver::CreateVideoProducerTrack - Cannot produce video";
+		return false;
+	}
+
+	return true;
+}
+
+// Scalability mode used when the frontend gives no encodings, empty means regular simulcast
+std::string MediaSoupTransceiver::GetDefaultScalabilityMode(const nlohmann::json *codec)
+{
+	std::string mimeType;
+
+	try {
+		if (codec != nullptr) {
+			mimeType = codec->value("mimeType", "");
+		} else {
+			// Otherwise the first video codec the router offers is what gets negotiated
+			for (auto &itr : m_device->GetRtpCapabilities()["codecs"]) {
+				if (itr.value("kind", "") == "video" && itr.value("mimeType", "") != "video/rtx") {
+					mimeType = itr.value("mimeType", "");
+					break;
+				}
+			}
+		}
+	} catch (...) {
+		return "";
+	}
+
+	std::transform(mimeType.begin(), mimeType.end(), mimeType.begin(), ::tolower);
+
+	if (mimeType == "video/vp9")
+		return "L3T3_KEY";
+
+	// libaom is costly in software, keep a single spatial layer and let temporal layers do the thinning
+	if (mimeType == "video/av1")
+		return "L1T3";
+
+	return "";
+}
+
+bool MediaSoupTransceiver::StartPassthrough(const std::string &encoderName, json &output_codec)
+{
+	if (m_passthroughTap == nullptr || m_passthroughTap->Active()) {
+		m_lastErorMsg = "MediaSoupTransceiver::StartPassthrough - Passthrough already in use";
+		return false;
+	}
+
+	obs_encoder_t *encoder = obs_get_encoder_by_name(encoderName.c_str());
+
+	if (encoder == nullptr) {
+		m_lastErorMsg = "MediaSoupTransceiver::StartPassthrough - Encoder not found";
+		return false;
+	}
+
+	bool started = m_passthroughTap->Start(encoder);
+	obs_encoder_release(encoder);
+
+	if (!started) {
+		m_lastErorMsg = "MediaSoupTransceiver::StartPassthrough - Unable to tap the encoder";
+		return false;
+	}
+
+	// Pick the router's h264 entry, packetization-mode 1 is what webrtc's packetizer produces
+	for (auto &itr : m_device->GetRtpCapabilities()["codecs"]) {
+		if (itr.value("mimeType", "") != "video/H264")
+			continue;
+
+		if (itr.value("parameters", json::object()).value("packetization-mode", 0) == 1) {
+			output_codec = itr;
+			break;
+		}
+	}
+
+	if (output_codec.empty()) {
+		m_passthroughTap->Stop();
+		m_lastErorMsg = "MediaSoupTransceiver::StartPassthrough - Router does not support h264";
+		return false;
+	}
+
+	return true;
+}
+
+rtc::scoped_refptr<webrtc::VideoTrackInterface>
+MediaSoupTransceiver::CreateProducerVideoTrack(rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory, const std::string &label,
+					       std::shared_ptr<MediaSoupMailbox> ptr, const bool isScreencast)
+{
+	// The factory handles cleanup of this cstyle pointer
+	auto videoTrackSource = new rtc::RefCountedObject<FrameGeneratorCapturerVideoTrackSource>(FrameGeneratorCapturerVideoTrackSource::Config(),
+												  webrtc::Clock::GetRealTimeClock(), isScreencast, ptr);
+	videoTrackSource->Start();
+
+	return factory->CreateVideoTrack(rtc::CreateRandomUuid(), videoTrackSource);
+}
+
+// Applied to the live sender, no renegotiation and no new produce handshake
+bool MediaSoupTransceiver::UpdateProducerEncodings(const std::string &id, const nlohmann::json &params, nlohmann::json &output_encodings)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_producerMutex);
+
+	auto itr = m_dataProducers.find(id);
+
+	if (itr == m_dataProducers.end() || itr->second.first == nullptr) {
+		m_lastErorMsg = "MediaSoupTransceiver::UpdateProducerEncodings - Producer not found";
+		return false;
+	}
+
+	mediasoupclient::Producer *producer = itr->second.first;
+
+	if (producer->GetKind() != "video") {
+		m_lastErorMsg = "MediaSoupTransceiver::UpdateProducerEncodings - Not a video producer";
+		return false;
+	}
+
+	webrtc::RtpSenderInterface *sender = producer->GetRtpSender();
+	webrtc::RtpParameters parameters = sender->GetParameters();
+
+	try {
+		if (params.contains("encodings")) {
+			size_t index = 0;
+
+			for (auto &item : params["encodings"]) {
+				// Matched by rid when given, by position otherwise
+				webrtc::RtpEncodingParameters *encoding = nullptr;
+
+				if (item.contains("rid")) {
+					for (auto &candidate : parameters.encodings) {
+						if (candidate.rid == item["rid"].get<std::string>())
+							encoding = &candidate;
+					}
+				} else if (index < parameters.encodings.size()) {
+					encoding = &parameters.encodings[index];
+				}
+
+				++index;
+
+				if (encoding == nullptr)
+					continue;
+
+				if (item.contains("active"))
+					encoding->active = item["active"].get<bool>();
+
+				if (item.contains("maxBitrate"))
+					encoding->max_bitrate_bps = item["maxBitrate"].is_null() ? absl::optional<int>() : item["maxBitrate"].get<int>();
+
+				if (item.contains("maxFramerate"))
+					encoding->max_framerate = item["maxFramerate"].is_null() ? absl::optional<double>() : item["maxFramerate"].get<double>();
+
+				if (item.contains("scaleResolutionDownBy"))
+					encoding->scale_resolution_down_by =
+						item["scaleResolutionDownBy"].is_null() ? absl::optional<double>() : item["scaleResolutionDownBy"].get<double>();
+			}
+		}
+
+		if (params.contains("degradationPreference")) {
+			std::string preference = params["degradationPreference"].get<std::string>();
+
+			if (preference == "maintain-framerate")
+				parameters.degradation_preference = webrtc::DegradationPreference::MAINTAIN_FRAMERATE;
+			else if (preference == "maintain-resolution")
+				parameters.degradation_preference = webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+			else if (preference == "balanced")
+				parameters.degradation_preference = webrtc::DegradationPreference::BALANCED;
+			else if (preference == "disabled")
+				parameters.degradation_preference = webrtc::DegradationPreference::DISABLED;
+		}
+	} catch (...) {
+		m_lastErorMsg = "MediaSoupTransceiver::UpdateProducerEncodings - Bad parameters";
+		return false;
+	}
+
+	webrtc::RTCError error = sender->SetParameters(parameters);
+
+	if (!error.ok()) {
+		m_lastErorMsg = std::string("MediaSoupTransceiver::UpdateProducerEncodings - ") + error.message();
+		return false;
+	}
+
+	if (params.contains("contentHint") && params["contentHint"].is_string()) {
+		if (auto track = static_cast<webrtc::VideoTrackInterface *>(producer->GetTrack()))
+			track->set_content_hint(ToContentHint(params["contentHint"].get<std::string>()));
+	}
+
+	output_encodings = json::array();
+
+	for (auto &encoding : sender->GetParameters().encodings) {
+		json entry;
+		entry["rid"] = encoding.rid;
+		entry["active"] = encoding.active;
+
+		if (encoding.max_bitrate_bps.has_value())
+			entry["maxBitrate"] = encoding.max_bitrate_bps.value();
+
+		if (encoding.max_framerate.has_value())
+			entry["maxFramerate"] = encoding.max_framerate.value();
+
+		if (encoding.scale_resolution_down_by.has_value())
+			entry["scaleResolutionDownBy"] = encoding.scale_resolution_down_by.value();
+
+		if (encoding.scalability_mode.has_value())
+			entry["scalabilityMode"] = encoding.scalability_mode.value();
+
+		output_encodings.push_back(entry);
+	}
+
+	return true;
+}
+
+// Whether the producer takes raw frames from a filter, so its filter can move and its track be replaced
+bool MediaSoupTransceiver::CanReplaceProducerTrack(const std::string &id)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
+	std::lock_guard<std::recursive_mutex> grd2(m_producerMutex);
+
+	if (m_factory_Producer == nullptr) {
+		m_lastErorMsg = "MediaSoupTransceiver::ReplaceProducerTrack - Factory not yet created";
+		return false;
+	}
+
+	auto itr = m_dataProducers.find(id);
+
+	if (itr == m_dataProducers.end() || itr->second.first == nullptr) {
+		m_lastErorMsg = "MediaSoupTransceiver::ReplaceProducerTrack - Producer not found";
+		return false;
+	}
+
+	if (itr->second.first->GetKind() != "video") {
+		m_lastErorMsg = "MediaSoupTransceiver::ReplaceProducerTrack - Not a video producer";
+		return false;
+	}
+
+	if (id == m_passthroughProducer) {
+		m_lastErorMsg = "MediaSoupTransceiver::ReplaceProducerTrack - Passthrough producers do not use a raw track";
+		return false;
+	}
+
+	return true;
+}
+
+// Only needed when the content hint changes, the new track reads from the same mailbox as the old one
+// No signaling is involved and remote consumers keep receiving on the same producer
+bool MediaSoupTransceiver::ReplaceProducerTrack(const std::string &id, const std::string &contentHint)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
+	std::lock_guard<std::recursive_mutex> grd2(m_producerMutex);
+
+	if (!CanReplaceProducerTrack(id))
+		return false;
+
+	auto itr = m_dataProducers.find(id);
+	mediasoupclient::Producer *producer = itr->second.first;
+
+	webrtc::VideoTrackInterface::ContentHint hint = ToContentHint(contentHint);
+	auto currentTrack = static_cast<webrtc::VideoTrackInterface *>(producer->GetTrack());
+
+	// No hint or the same one, the track is fine as it is
+	if (contentHint.empty() || (currentTrack != nullptr && currentTrack->content_hint() == hint))
+		return true;
+
+	bool isScreencast = hint == webrtc::VideoTrackInterface::ContentHint::kDetailed || hint == webrtc::VideoTrackInterface::ContentHint::kText;
+
+	// Built on the producer's existing mailbox, the filter feeding it carries on without noticing
+	auto videoTrack = CreateProducerVideoTrack(m_factory_Producer, std::to_string(rtc::CreateRandomId()), itr->second.second, isScreencast);
+	videoTrack->set_content_hint(hint);
+
+	try {
+		producer->ReplaceTrack(videoTrack.get());
+	} catch (...) {
+		m_lastErorMsg = "MediaSoupTransceiver::ReplaceProducerTrack - ReplaceTrack failed";
+		return false;
+	}
+
+	// The previous track and its capturer go away with the sender's last reference
+	return true;
+}
+
+// Local only, the server side consumer is the front end's job (see func_consumer_state)
+bool MediaSoupTransceiver::SetConsumerPaused(const std::string &id, const bool paused)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr) {
+		m_lastErorMsg = "Consumer not found";
+		return false;
+	}
+
+	mediasoupclient::Consumer *consumer = itr->second.first;
+
+	if (consumer->IsPaused() == paused)
+		return true;
+
+	if (paused)
+		consumer->Pause();
+	else
+		consumer->Resume();
+
+	return true;
+}
+
+// Shared audio consumers play through one source, moved when that source goes away
+bool MediaSoupTransceiver::SetConsumerAudioSource(const std::string &id, obs_source_t *source)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.second == nullptr || itr->second.second->m_consumerType != ConsumerAudio) {
+		m_lastErorMsg = "Audio consumer not found";
+		return false;
+	}
+
+	itr->second.second->m_obs_source = source;
+	return true;
+}
+
+// Null hands the consumer back to its own source
+bool MediaSoupTransceiver::SetConsumerAudioMixer(const std::string &id, std::shared_ptr<MediaSoupAudioMixer> mixer)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.second == nullptr || itr->second.second->m_consumerType != ConsumerAudio) {
+		m_lastErorMsg = "Audio consumer not found";
+		return false;
+	}
+
+	MyAudioSink *sink = static_cast<MyAudioSink *>(itr->second.second.get());
+
+	// Otherwise the old mixer keeps waiting on an input that never delivers again, push ignores ids it doesn't have
+	auto previous = std::atomic_load(&sink->m_mixer);
+
+	if (previous != nullptr && previous != mixer)
+		previous->removeInput(id);
+
+	std::atomic_store(&sink->m_mixer, mixer);
+	return true;
+}
+
+bool MediaSoupTransceiver::ConsumerPaused(const std::string &id)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr)
+		return false;
+
+	return itr->second.first->IsPaused();
+}
+
+// Called by each source twice a second, feeds the decode scheduler and applies whatever it changed
+bool MediaSoupTransceiver::UpdateConsumerDisplay(const std::string &id, const int displayPixels, const int canvasFramerate, const bool visible)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr) {
+		m_lastErorMsg = "Consumer not found";
+		return false;
+	}
+
+	if (MyVideoSink *videoSink = dynamic_cast<MyVideoSink *>(itr->second.second.get()))
+		m_decodeScheduler.updateDecoded(id, videoSink->m_decodedPixels.exchange(0), videoSink->m_largestFramePixels.exchange(0), os_gettime_ns());
+
+	m_decodeScheduler.updateDisplay(id, displayPixels, canvasFramerate, visible);
+
+	for (auto &changedId : m_decodeScheduler.schedule()) {
+		MediaSoupDecodeScheduler::Assignment assignment;
+
+		if (m_decodeScheduler.getAssignment(changedId, assignment))
+			UpdateConsumerSinkWants(changedId, assignment.maxPixelCount, assignment.maxFramerate);
+	}
+
+	return true;
+}
+
+void MediaSoupTransceiver::SetDecodeBudget(const int64_t pixelsPerSecond)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+	m_decodeScheduler.setBudget(pixelsPerSecond);
+
+	for (auto &changedId : m_decodeScheduler.schedule()) {
+		MediaSoupDecodeScheduler::Assignment assignment;
+
+		if (m_decodeScheduler.getAssignment(changedId, assignment))
+			UpdateConsumerSinkWants(changedId, assignment.maxPixelCount, assignment.maxFramerate);
+	}
+}
+
+json MediaSoupTransceiver::GetLayerRequests()
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+	return m_decodeScheduler.getLayerRequests();
+}
+
+// 0 means no limit
+bool MediaSoupTransceiver::UpdateConsumerSinkWants(const std::string &id, const int maxPixelCount, const int maxFramerate)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr) {
+		m_lastErorMsg = "Consumer not found";
+		return false;
+	}
+
+	MyVideoSink *videoSink = dynamic_cast<MyVideoSink *>(itr->second.second.get());
+	webrtc::VideoTrackInterface *track = dynamic_cast<webrtc::VideoTrackInterface *>(itr->second.first->GetTrack());
+
+	if (videoSink == nullptr || track == nullptr) {
+		m_lastErorMsg = "Not a video consumer";
+		return false;
+	}
+
+	rtc::VideoSinkWants wants;
+	wants.resolution_alignment = 2;
+
+	if (maxPixelCount > 0 && !videoSink->m_asyncOutput)
+		wants.max_pixel_count = maxPixelCount;
+
+	if (maxFramerate > 0)
+		wants.max_framerate_fps = maxFramerate;
+
+	videoSink->m_adapter.OnSinkWants(wants);
+
+	// Still tell the track, it forwards the wants to the source and lets it know frames are being discarded
+	track->AddOrUpdateSink(videoSink, wants);
+	return true;
+}
+
+webrtc::VideoTrackInterface::ContentHint MediaSoupTransceiver::ToContentHint(const std::string &value)
+{
+	if (value == "motion")
+		return webrtc::VideoTrackInterface::ContentHint::kFluid;
+
+	if (value == "detail")
+		return webrtc::VideoTrackInterface::ContentHint::kDetailed;
+
+	if (value == "text")
+		return webrtc::VideoTrackInterface::ContentHint::kText;
+
+	return webrtc::VideoTrackInterface::ContentHint::kNone;
+}
+
+// "minimal" and "smooth" trade latency for resilience either way, "custom" takes delayMs, "default" leaves it to webrtc
+// "minimal" also holds the total to targetMs, see EnforceJitterTarget
+bool MediaSoupTransceiver::GetJitterPresetDelay(const std::string &preset, const int delayMs, absl::optional<int> &output)
+{
+	if (preset == "default") {
+		output = absl::nullopt;
+		return true;
+	}
+
+	if (preset == "minimal") {
+		output = 0;
+		return true;
+	}
+
+	if (preset == "smooth") {
+		output = getSmoothJitterBufferDelayMs();
+		return true;
+	}
+
+	if (preset == "custom") {
+		output = std::max(0, std::min(delayMs, 10000));
+		return true;
+	}
+
+	return false;
+}
+
+bool MediaSoupTransceiver::ApplyJitterBuffer(mediasoupclient::Consumer *consumer, GenericSink &sink, const std::string &preset, const int delayMs,
+					     const int targetMs)
+{
+	absl::optional<int> minimumDelayMs;
+
+	if (!GetJitterPresetDelay(preset, delayMs, minimumDelayMs)) {
+		m_lastErorMsg = "Unknown jitter buffer preset " + preset;
+		return false;
+	}
+
+	webrtc::RtpReceiverInterface *receiver = consumer->GetRtpReceiver();
+
+	if (receiver == nullptr) {
+		m_lastErorMsg = "Consumer has no receiver";
+		return false;
+	}
+
+	// Applies to neteq for audio and the frame buffer for video
+	if (minimumDelayMs.has_value())
+		receiver->SetJitterBufferMinimumDelay(minimumDelayMs.value() / 1000.0);
+	else
+		receiver->SetJitterBufferMinimumDelay(absl::nullopt);
+
+	sink.m_jitterPreset = preset;
+	sink.m_jitterMinimumDelayMs = minimumDelayMs;
+	sink.m_jitterTargetMs = targetMs > 0 ? targetMs : getDefaultJitterTargetMs();
+
+	if (preset != "minimal")
+		sink.m_presentationCutMs = 0;
+	else
+		StartJitterThread();
+
+	return true;
+}
+
+bool MediaSoupTransceiver::SetConsumerJitterBuffer(const std::string &id, const std::string &preset, const int delayMs, const int targetMs)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr || itr->second.second == nullptr) {
+		m_lastErorMsg = "Consumer not found";
+		return false;
+	}
+
+	return ApplyJitterBuffer(itr->second.first, *itr->second.second, preset, delayMs, targetMs);
+}
+
+// Existing consumers are switched over as well
+bool MediaSoupTransceiver::SetDefaultJitterBuffer(const std::string &preset, const int delayMs, const int targetMs)
+{
+	absl::optional<int> unused;
+
+	if (!GetJitterPresetDelay(preset, delayMs, unused)) {
+		m_lastErorMsg = "Unknown jitter buffer preset " + preset;
+		return false;
+	}
+
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+	m_defaultJitterPreset = preset;
+	m_defaultJitterDelayMs = delayMs;
+	m_defaultJitterTargetMs = targetMs;
+
+	for (auto &itr : m_dataConsumers) {
+		if (itr.second.first != nullptr && itr.second.second != nullptr)
+			ApplyJitterBuffer(itr.second.first, *itr.second.second, preset, delayMs, targetMs);
+	}
+
+	return true;
+}
+
+// Empty id reports every consumer
+// Total latency here is what we control or can measure on the receive side: jitter buffer plus the common presentation delay
+json MediaSoupTransceiver::GetJitterBufferState(const std::string &id)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	json consumers = json::array();
+	const int presentationDelayMs = MediaSoupSyncEngine::instance().getPresentationDelayMs();
+
+	for (auto &itr : m_dataConsumers) {
+		if ((!id.empty() && itr.first != id) || itr.second.first == nullptr || itr.second.second == nullptr)
+			continue;
+
+		GenericSink &sink = *itr.second.second;
+		json stats;
+
+		try {
+			stats = itr.second.first->GetStats();
+		} catch (...) {
+		}
+
+		const int jitterBufferMs = MeasureJitterBufferMs(stats, sink.m_reportBaseline);
+		const int consumerDelayMs = std::max(0, presentationDelayMs - sink.m_presentationCutMs.load());
+		const int totalMs = jitterBufferMs + consumerDelayMs;
+		const int targetMs = sink.m_jitterTargetMs > 0 ? sink.m_jitterTargetMs : getDefaultJitterTargetMs();
+
+		json consumer;
+		consumer["id"] = itr.first;
+		consumer["kind"] = sink.m_consumerType == ConsumerAudio ? "audio" : "video";
+		consumer["preset"] = sink.m_jitterPreset;
+		consumer["minimumDelayMs"] = sink.m_jitterMinimumDelayMs.has_value() ? json(sink.m_jitterMinimumDelayMs.value()) : json(nullptr);
+		consumer["jitterBufferMs"] = jitterBufferMs;
+		consumer["presentationDelayMs"] = consumerDelayMs;
+		consumer["totalMs"] = totalMs;
+		consumer["targetMs"] = targetMs;
+		consumer["withinTarget"] = totalMs <= targetMs;
+		consumers.push_back(consumer);
+	}
+
+	json output;
+	output["consumers"] = consumers;
+	return output;
+}
+
+// Average jitter buffer delay since the baseline, or the last one measured when nothing was emitted in between
+int MediaSoupTransceiver::MeasureJitterBufferMs(const json &stats, JitterBaseline &baseline)
+{
+	try {
+		for (auto &itr : stats) {
+			if (itr.value("type", "") != "inbound-rtp")
+				continue;
+
+			const double delaySeconds = itr.value("jitterBufferDelay", 0.0);
+			const uint64_t emitted = itr.value("jitterBufferEmittedCount", uint64_t(0));
+
+			if (emitted > baseline.m_emitted && delaySeconds >= baseline.m_delaySeconds)
+				baseline.m_averageMs = int((delaySeconds - baseline.m_delaySeconds) * 1000.0 / double(emitted - baseline.m_emitted));
+
+			baseline.m_delaySeconds = delaySeconds;
+			baseline.m_emitted = emitted;
+			break;
+		}
+	} catch (...) {
+	}
+
+	return baseline.m_averageMs;
+}
+
+// Called from the source's tick, cheap, the enforcer thread does the measuring
+void MediaSoupTransceiver::SetJitterPartners(const std::string &videoId, const std::string &audioId)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto video = videoId.empty() ? m_dataConsumers.end() : m_dataConsumers.find(videoId);
+	auto audio = audioId.empty() ? m_dataConsumers.end() : m_dataConsumers.find(audioId);
+
+	if (video != m_dataConsumers.end() && video->second.second != nullptr)
+		video->second.second->m_jitterPartnerId = audioId;
+
+	if (audio != m_dataConsumers.end() && audio->second.second != nullptr)
+		audio->second.second->m_jitterPartnerId = videoId;
+}
+
+void MediaSoupTransceiver::StartJitterThread()
+{
+	std::lock_guard<std::mutex> grd(m_jitterThreadMutex);
+
+	if (m_jitterThreadRunning)
+		return;
+
+	if (m_jitterThread.joinable())
+		m_jitterThread.join();
+
+	m_jitterThreadRunning = true;
+	m_jitterThread = std::thread(&MediaSoupTransceiver::JitterThread, this);
+}
+
+void MediaSoupTransceiver::StopJitterThread()
+{
+	{
+		std::lock_guard<std::mutex> grd(m_jitterThreadMutex);
+		m_jitterThreadRunning = false;
+	}
+
+	m_jitterThreadCv.notify_all();
+
+	if (m_jitterThread.joinable())
+		m_jitterThread.join();
+}
+
+void MediaSoupTransceiver::JitterThread()
+{
+	std::unique_lock<std::mutex> lock(m_jitterThreadMutex);
+
+	while (!m_jitterThreadCv.wait_for(lock, std::chrono::milliseconds(getJitterEnforceIntervalMs()), [this] { return !m_jitterThreadRunning; })) {
+		lock.unlock();
+		EnforceJitterTargets();
+		lock.lock();
+	}
+}
+
+// One pass per participant with a "minimal" consumer, cuts nobody claims anymore go back to 0
+void MediaSoupTransceiver::EnforceJitterTargets()
+{
+	std::set<std::pair<std::string, std::string>> participants;
+
+	{
+		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+		for (auto &itr : m_dataConsumers) {
+			GenericSink *sink = itr.second.second.get();
+
+			if (itr.second.first == nullptr || sink == nullptr || sink->m_jitterPreset != "minimal")
+				continue;
+
+			if (sink->m_consumerType == ConsumerAudio)
+				participants.emplace(sink->m_jitterPartnerId, itr.first);
+			else
+				participants.emplace(itr.first, sink->m_jitterPartnerId);
+		}
+
+		for (auto &itr : m_dataConsumers) {
+			GenericSink *sink = itr.second.second.get();
+
+			if (sink == nullptr || sink->m_presentationCutMs == 0)
+				continue;
+
+			const std::string &partnerId = sink->m_jitterPartnerId;
+			const bool claimed = sink->m_consumerType == ConsumerAudio ? participants.count({partnerId, itr.first}) != 0
+										 : participants.count({itr.first, partnerId}) != 0;
+
+			if (!claimed)
+				sink->m_presentationCutMs = 0;
+		}
+	}
+
+	for (auto &itr : participants)
+		EnforceJitterTarget(itr.first, itr.second);
+}
+
+// GetStats without m_consumerMutex, so the graphics thread and the signaling callbacks never wait on it
+bool MediaSoupTransceiver::MeasureConsumerJitterMs(const std::string &id, int &output)
+{
+	mediasoupclient::Consumer *consumer = nullptr;
+	std::unique_lock<std::mutex> measureLock;
+	json stats;
+
+	{
+		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+		auto itr = m_dataConsumers.find(id);
+
+		if (itr == m_dataConsumers.end() || itr->second.first == nullptr || itr->second.second == nullptr)
+			return false;
+
+		consumer = itr->second.first;
+		measureLock = std::unique_lock<std::mutex>(m_jitterMeasureMutex);
+	}
+
+	try {
+		stats = consumer->GetStats();
+	} catch (...) {
+	}
+
+	measureLock.unlock();
+
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.second == nullptr)
+		return false;
+
+	output = MeasureJitterBufferMs(stats, itr->second.second->m_enforceBaseline);
+	return true;
+}
+
+// "minimal" can't go below webrtc's jitter buffer, so what's over the target comes off the presentation delay instead
+// Webrtc syncs a participant's audio and video, both get the same cut so they stay in sync after it
+// Mixed audio shares one clock with every other participant, so a participant going through a mixer isn't cut
+void MediaSoupTransceiver::EnforceJitterTarget(const std::string &videoId, const std::string &audioId)
+{
+	std::vector<std::string> ids;
+	int targetMs = 0;
+
+	{
+		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+		std::vector<GenericSink *> sinks;
+		bool mixed = false;
+
+		for (auto &id : {videoId, audioId}) {
+			auto itr = id.empty() ? m_dataConsumers.end() : m_dataConsumers.find(id);
+
+			if (itr == m_dataConsumers.end() || itr->second.first == nullptr || itr->second.second == nullptr)
+				continue;
+
+			GenericSink *sink = itr->second.second.get();
+
+			if (sink->m_consumerType == ConsumerAudio && std::atomic_load(&static_cast<MyAudioSink *>(sink)->m_mixer) != nullptr)
+				mixed = true;
+
+			if (sink->m_jitterPreset == "minimal") {
+				const int sinkTargetMs = sink->m_jitterTargetMs > 0 ? sink->m_jitterTargetMs : getDefaultJitterTargetMs();
+				targetMs = targetMs > 0 ? std::min(targetMs, sinkTargetMs) : sinkTargetMs;
+			}
+
+			sinks.push_back(sink);
+			ids.push_back(id);
+		}
+
+		if (mixed || targetMs == 0) {
+			for (auto sink : sinks)
+				sink->m_presentationCutMs = 0;
+
+			return;
+		}
+	}
+
+	int jitterBufferMs = 0;
+
+	for (auto &id : ids) {
+		int measuredMs = 0;
+
+		if (MeasureConsumerJitterMs(id, measuredMs))
+			jitterBufferMs = std::max(jitterBufferMs, measuredMs);
+	}
+
+	const int presentationDelayMs = MediaSoupSyncEngine::instance().getPresentationDelayMs();
+	const int cutMs = std::max(0, std::min(jitterBufferMs + presentationDelayMs - targetMs, presentationDelayMs));
+
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	for (auto &id : ids) {
+		auto itr = m_dataConsumers.find(id);
+
+		if (itr != m_dataConsumers.end() && itr->second.second != nullptr)
+			itr->second.second->m_presentationCutMs = cutMs;
+	}
+}
+
+// Loudest first, levels come from the decoded audio and fall back to the RFC 6464 header extension while nothing is being decoded
+json MediaSoupTransceiver::GetAudioLevels()
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	const uint64_t now = os_gettime_ns();
+	const int64_t nowMs = rtc::TimeMillis();
+	std::vector<json> consumers;
+
+	std::string loudest;
+	float loudestLevel = -128.f;
+	float activeLevel = -128.f;
+	bool activeSpeaking = false;
+
+	for (auto &itr : m_dataConsumers) {
+		if (itr.second.first == nullptr || itr.second.second == nullptr || itr.second.second->m_consumerType != ConsumerAudio)
+			continue;
+
+		MyAudioSink &sink = static_cast<MyAudioSink &>(*itr.second.second);
+		float level = sink.m_levelDbov;
+		bool speaking = sink.m_speaking;
+		std::string source = "decoded";
+
+		// Paused or not pulled, the sender's own measurement still arrives with every packet
+		if (now - sink.m_levelUpdatedNs > 500000000) {
+			level = -127.f;
+			speaking = false;
+			source = "none";
+
+			if (webrtc::RtpReceiverInterface *receiver = itr.second.first->GetRtpReceiver()) {
+				for (auto &rtpSource : receiver->GetSources()) {
+					if (rtpSource.source_type() != webrtc::RtpSourceType::SSRC || !rtpSource.audio_level().has_value() ||
+					    nowMs - rtpSource.timestamp_ms() > 1000)
+						continue;
+
+					level = -float(rtpSource.audio_level().value());
+					speaking = level > getSpeakingOnDbov();
+					source = "rfc6464";
+					break;
+				}
+			}
+		}
+
+		json consumer;
+		consumer["id"] = itr.first;
+		consumer["levelDbov"] = level;
+		consumer["peak"] = float(sink.m_peak.exchange(0)) / 32768.f;
+		consumer["speaking"] = speaking;
+		consumer["source"] = source;
+		consumers.push_back(consumer);
+
+		if (speaking && level > loudestLevel) {
+			loudest = itr.first;
+			loudestLevel = level;
+		}
+
+		if (itr.first == m_activeSpeaker) {
+			activeLevel = level;
+			activeSpeaking = speaking;
+		}
+	}
+
+	// Holds on to the current speaker through short overlaps, a quiet or departed one is replaced right away
+	if (!loudest.empty() && loudest != m_activeSpeaker) {
+		const bool held = activeSpeaking && now - m_activeSpeakerSinceNs < getActiveSpeakerHoldNs();
+
+		if (!activeSpeaking || (!held && loudestLevel > activeLevel + getActiveSpeakerMarginDb())) {
+			m_activeSpeaker = loudest;
+			m_activeSpeakerSinceNs = now;
+		}
+	}
+
+	std::sort(consumers.begin(), consumers.end(), [](const json &a, const json &b) { return a["levelDbov"].get<float>() > b["levelDbov"].get<float>(); });
+
+	json output;
+	output["activeSpeaker"] = m_activeSpeaker.empty() || m_dataConsumers.find(m_activeSpeaker) == m_dataConsumers.end() ? json(nullptr) : json(m_activeSpeaker);
+	output["consumers"] = consumers;
+	return output;
+}
+
+// Asks for a keyframe as soon as the transport is up, until the consumer has delivered a frame
+// A consumer that doesn't exist yet is still being created (the first one waits on the connect round trip), so the caller keeps trying
+MediaSoupTransceiver::FirstFrameState MediaSoupTransceiver::RequestFirstKeyFrame(const std::string &id)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr || itr->second.second == nullptr)
+		return FirstFrameNoConsumer;
+
+	GenericSink &sink = *itr->second.second;
+
+	// Nothing to wait for on audio
+	if (sink.m_consumerType != ConsumerVideo || sink.m_firstFrameNs != 0)
+		return FirstFrameReceived;
+
+	const std::string state = GetConnectionState(m_recvTransport);
+	const uint64_t now = os_gettime_ns();
+
+	if ((state != "connected" && state != "completed") || now - sink.m_lastKeyFrameRequestNs < getKeyFrameRetryNs())
+		return FirstFrameWaiting;
+
+	auto track = dynamic_cast<webrtc::VideoTrackInterface *>(itr->second.first->GetTrack());
+
+	// The source proxy runs this on the worker thread, which sends the PLI
+	if (track != nullptr && track->GetSource() != nullptr)
+		track->GetSource()->GenerateKeyFrame();
+
+	sink.m_lastKeyFrameRequestNs = now;
+	++sink.m_keyFrameRequests;
+	return FirstFrameWaiting;
+}
+
+json MediaSoupTransceiver::GetConsumerStats()
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	const uint64_t now = os_gettime_ns();
+	json consumers = json::array();
 
-		if (iceServers != nullptr) {
-			blog(LOG_DEBUG, "MediaSoupTransceiver::CreateSender - Using iceServers %s", iceServers->dump().c_str());
+	for (auto &itr : m_dataConsumers) {
+		if (itr.second.second == nullptr)
+			continue;
 
-			for (const auto &iceServerUri : *iceServers) {
-				webrtc::PeerConnectionInterface::IceServer iceServer;
-				iceServer.username = iceServerUri["username"].get<std::string>();
-				iceServer.password = iceServerUri["credential"].get<std::string>();
-				iceServer.urls = iceServerUri["urls"].get<std::vector<std::string>>();
-				m_producerOptions.config.servers.push_back(iceServer);
-			}
-		} else {
-			blog(LOG_DEBUG, "MediaSoupTransceiver::CreateSender - Not using iceServers");
-		}
+		GenericSink &sink = *itr.second.second;
+		const uint64_t firstFrameNs = sink.m_firstFrameNs;
 
-		m_sendTransport = m_device->CreateSendTransport(this, id, iceParameters, iceCandidates, dtlsParameters, &m_producerOptions);
-	} catch (...) {
-		m_lastErorMsg = "Unable to create the send transport";
-		return false;
+		json consumer;
+		consumer["id"] = itr.first;
+		consumer["kind"] = sink.m_consumerType == ConsumerAudio ? "audio" : "video";
+		consumer["timeToFirstFrameMs"] = firstFrameNs != 0 ? json((firstFrameNs - sink.m_createdNs) / 1000000) : json(nullptr);
+		consumer["ageMs"] = (now - sink.m_createdNs) / 1000000;
+		consumer["keyFrameRequests"] = sink.m_keyFrameRequests;
+		consumers.push_back(consumer);
 	}
 
-	return true;
+	json output;
+	output["consumers"] = consumers;
+	return output;
 }
 
-bool MediaSoupTransceiver::CreateVideoProducerTrack(const std::string &id, const nlohmann::json *ecodings /*= nullptr*/,
-						    const nlohmann::json *codecOptions /*= nullptr*/, const nlohmann::json *codec /*= nullptr*/)
+// Video goes to ivf from the track source's encoded output, audio to ogg from a tap ahead of the decoder
+bool MediaSoupTransceiver::StartConsumerRecording(const std::string &id, const std::string &path)
 {
-	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
 
-	if (m_device == nullptr) {
-		m_lastErorMsg = "Device not created";
-		return false;
-	}
+	auto itr = m_dataConsumers.find(id);
 
-	if (m_factory_Producer == nullptr) {
-		m_lastErorMsg = "Factory not yet created";
+	if (itr == m_dataConsumers.end() || itr->second.first == nullptr || itr->second.second == nullptr) {
+		m_lastErorMsg = "Consumer not found";
 		return false;
 	}
 
-	if (m_sendTransport == nullptr) {
-		m_lastErorMsg = "Transport not created";
+	mediasoupclient::Consumer *consumer = itr->second.first;
+	GenericSink &sink = *itr->second.second;
+
+	if (sink.m_recorder != nullptr) {
+		m_lastErorMsg = "Consumer is already recording";
 		return false;
 	}
 
-	if (m_device->CanProduce("video")) {
-		auto mailbox = std::make_shared<MediaSoupMailbox>();
-		auto videoTrack = CreateProducerVideoTrack(m_factory_Producer, std::to_string(rtc::CreateRandomId()), mailbox);
-
-		std::vector<webrtc::RtpEncodingParameters> encodings;
+	if (sink.m_consumerType == ConsumerVideo) {
+		auto track = dynamic_cast<webrtc::VideoTrackInterface *>(consumer->GetTrack());
+		rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source = track != nullptr ? track->GetSource() : nullptr;
 
-		if (ecodings != nullptr) {
-			for (auto &itr : *ecodings) {
-				webrtc::RtpEncodingParameters option;
-				option.max_bitrate_bps = itr["maxBitrate"].get<int>();
-				option.scale_resolution_down_by = itr["scaleResolutionDownBy"].get<int>();
-				encodings.emplace_back(option);
-			}
-		} else {
-			encodings.emplace_back(webrtc::RtpEncodingParameters{});
-			encodings.emplace_back(webrtc::RtpEncodingParameters{});
-			encodings.emplace_back(webrtc::RtpEncodingParameters{});
+		if (source == nullptr || !source->SupportsEncodedOutput()) {
+			m_lastErorMsg = "Consumer has no encoded output";
+			return false;
 		}
 
-		if (auto ptr = m_sendTransport->Produce(this, videoTrack, &encodings, codecOptions, codec)) {
-			AssignProducer(id, ptr, mailbox);
-		} else {
-			m_lastErorMsg = "MediaSoupTransceiver::CreateVideoProducerTrack - Transport failed to produce video";
+		auto recorder = std::make_shared<MediaSoupIvfRecorder>();
+
+		if (!recorder->open(path)) {
+			m_lastErorMsg = "Unable to open " + path;
 			return false;
 		}
+
+		// Also asks the sender for a keyframe to start on
+		source->AddEncodedSink(recorder.get());
+		sink.m_recordingSource = source;
+		sink.m_recorder = recorder;
 	} else {
-		m_lastErorMsg = "MediaSoupTransceiver::CreateVideoProducerTrack - Cannot produce video";
+		if (consumer->GetRtpReceiver() == nullptr) {
+			m_lastErorMsg = "Consumer has no receiver";
+			return false;
+		}
+
+		std::string mimeType;
+
+		try {
+			mimeType = consumer->GetRtpParameters().at("codecs").at(0).at("mimeType").get<std::string>();
+		} catch (...) {
+		}
+
+		std::transform(mimeType.begin(), mimeType.end(), mimeType.begin(), ::tolower);
+
+		// The tap writes payloads as they are, anything but opus would make a broken ogg opus file
+		if (mimeType != "audio/opus") {
+			m_lastErorMsg = "Only opus audio can be recorded, consumer is " + (mimeType.empty() ? std::string("unknown") : mimeType);
+			return false;
+		}
+
+		auto recorder = std::make_shared<MediaSoupOggOpusRecorder>();
+
+		if (!recorder->open(path)) {
+			m_lastErorMsg = "Unable to open " + path;
+			return false;
+		}
+
+		if (sink.m_opusTap == nullptr) {
+			sink.m_opusTap = new rtc::RefCountedObject<MediaSoupOpusTap>();
+			consumer->GetRtpReceiver()->SetDepacketizerToDecoderFrameTransformer(sink.m_opusTap);
+		}
+
+		sink.m_opusTap->setRecorder(recorder);
+		sink.m_recorder = recorder;
+	}
+
+	blog(LOG_INFO, "MediaSoupTransceiver::StartConsumerRecording - '%s' to '%s'", id.c_str(), path.c_str());
+	return true;
+}
+
+bool MediaSoupTransceiver::StopConsumerRecording(const std::string &id, json &output)
+{
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
+
+	auto itr = m_dataConsumers.find(id);
+
+	if (itr == m_dataConsumers.end() || itr->second.second == nullptr || itr->second.second->m_recorder == nullptr) {
+		m_lastErorMsg = "Consumer is not recording";
 		return false;
 	}
 
+	std::shared_ptr<MediaSoupRecorder> recorder = itr->second.second->m_recorder;
+	itr->second.second->stopRecording();
+	output = recorder->getStats();
 	return true;
 }
 
-rtc::scoped_refptr<webrtc::VideoTrackInterface>
-MediaSoupTransceiver::CreateProducerVideoTrack(rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory, const std::string &label,
-					       std::shared_ptr<MediaSoupMailbox> ptr)
+bool MediaSoupTransceiver::ConsumerRecording(const std::string &id)
 {
-	// The factory handles cleanup of this cstyle pointer
-	auto videoTrackSource = new rtc::RefCountedObject<FrameGeneratorCapturerVideoTrackSource>(FrameGeneratorCapturerVideoTrackSource::Config(),
-												  webrtc::Clock::GetRealTimeClock(), false, ptr);
-	videoTrackSource->Start();
+	std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
 
-	return factory->CreateVideoTrack(rtc::CreateRandomUuid(), videoTrackSource);
+	auto itr = m_dataConsumers.find(id);
+
+	// A recording stopped for backpressure keeps its recorder until func_stop_consumer_recording, but it isn't recording anymore
+	return itr != m_dataConsumers.end() && itr->second.second != nullptr && itr->second.second->m_recorder != nullptr &&
+	       itr->second.second->m_recorder->isOpen();
+}
+
+// Webrtc follows the usual channel orders, which are also what obs expects for these
+speaker_layout MediaSoupTransceiver::GetSpeakerLayout(const size_t channels)
+{
+	switch (channels) {
+	case 1:
+		return SPEAKERS_MONO;
+	case 2:
+		return SPEAKERS_STEREO;
+	case 3:
+		return SPEAKERS_2POINT1;
+	case 4:
+		return SPEAKERS_4POINT0;
+	case 5:
+		return SPEAKERS_4POINT1;
+	case 6:
+		return SPEAKERS_5POINT1;
+	case 8:
+		return SPEAKERS_7POINT1;
+	default:
+		return SPEAKERS_UNKNOWN;
+	}
 }
 
 bool MediaSoupTransceiver::CreateAudioProducerTrack(const std::string &id)
@@ -303,7 +1579,7 @@ bool MediaSoupTransceiver::CreateAudioProducerTrack(const std::string &id)
 		return false;
 	}
 
-	if (m_factory_Consumer == nullptr) {
+	if (m_factory_Producer == nullptr) {
 		m_lastErorMsg = "Factory not yet created";
 		return false;
 	}
@@ -381,15 +1657,19 @@ bool MediaSoupTransceiver::CreateAudioConsumer(const std::string &id, const std:
 	audioSink->m_mailbox = std::make_shared<MediaSoupMailbox>();
 	audioSink->m_consumerType = MediaSoupTransceiver::ConsumerType::ConsumerAudio;
 	audioSink->m_obs_source = source;
+	audioSink->m_consumerId = id;
 
 	auto trackRaw = consumer->GetTrack();
 	dynamic_cast<webrtc::AudioTrackInterface *>(trackRaw)->AddSink(audioSink.get());
 
 	AssignConsumer(id, consumer, std::move(audioSink));
+
+	std::lock_guard<std::recursive_mutex> grd2(m_consumerMutex);
+	SetConsumerJitterBuffer(id, m_defaultJitterPreset, m_defaultJitterDelayMs, m_defaultJitterTargetMs);
 	return true;
 }
 
-bool MediaSoupTransceiver::CreateVideoConsumer(const std::string &id, const std::string &producerId, json *rtpParameters)
+bool MediaSoupTransceiver::CreateVideoConsumer(const std::string &id, const std::string &producerId, json *rtpParameters, obs_source_t *asyncSource)
 {
 	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
 
@@ -414,14 +1694,22 @@ bool MediaSoupTransceiver::CreateVideoConsumer(const std::string &id, const std:
 
 	auto videoSink = std::make_unique<MyVideoSink>();
 	videoSink->m_mailbox = std::make_shared<MediaSoupMailbox>();
-	videoSink->m_consumerType = MediaSoupTransceiver::ConsumerType::ConsumerAudio;
+	videoSink->m_consumerType = MediaSoupTransceiver::ConsumerType::ConsumerVideo;
+	videoSink->m_obs_source = asyncSource;
+	videoSink->m_asyncOutput = asyncSource != nullptr;
 
 	auto trackRaw = consumer->GetTrack();
 
 	rtc::VideoSinkWants videoSinkWants;
+	videoSinkWants.resolution_alignment = 2;
+	videoSink->m_adapter.OnSinkWants(videoSinkWants);
 	dynamic_cast<webrtc::VideoTrackInterface *>(trackRaw)->AddOrUpdateSink(videoSink.get(), videoSinkWants);
 
 	AssignConsumer(id, consumer, std::move(videoSink));
+
+	std::lock_guard<std::recursive_mutex> grd2(m_consumerMutex);
+	m_decodeScheduler.addConsumer(id, *rtpParameters);
+	SetConsumerJitterBuffer(id, m_defaultJitterPreset, m_defaultJitterDelayMs, m_defaultJitterTargetMs);
 	return true;
 }
 
@@ -453,6 +1741,15 @@ std::future<std::string> MediaSoupTransceiver::OnProduce(mediasoupclient::SendTr
 	std::promise<std::string> promise;
 	std::string value;
 
+	if (kind == "video" && rtpParameters.contains("encodings")) {
+		auto &encodings = rtpParameters["encodings"];
+
+		for (size_t i = 0; i < encodings.size() && i < m_pendingScalabilityModes.size(); ++i) {
+			if (!m_pendingScalabilityModes[i].empty() && !encodings[i].contains("scalabilityMode"))
+				encodings[i]["scalabilityMode"] = m_pendingScalabilityModes[i];
+		}
+	}
+
 	if (ConnectorFrontApiHelper::onProduce(m_id, transport->GetId(), kind, rtpParameters, value))
 		promise.set_value(value);
 	else
@@ -501,10 +1798,13 @@ void MediaSoupTransceiver::StopReceiveTransport()
 
 		// Cleanup the consumers attached to it
 		for (auto &itr : m_dataConsumers) {
+			if (itr.second.second != nullptr)
+				itr.second.second->stopRecording();
+
 			if (itr.second.first != nullptr)
 				TryClose(itr.second.first);
 
-			delete itr.second.first;
+			DeleteConsumer(itr.second.first);
 		}
 	}
 
@@ -518,6 +1818,7 @@ void MediaSoupTransceiver::StopReceiveTransport()
 		// The sinks are in here too
 		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
 		m_dataConsumers.clear();
+		m_decodeScheduler.clear();
 	}
 }
 
@@ -525,6 +1826,10 @@ void MediaSoupTransceiver::StopSendTransport()
 {
 	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
 
+	// A warm up still running writes m_passthroughTap and the producer threads, wait() leaves the factory for whoever claims it
+	if (m_producerFactoryWarmup.valid())
+		m_producerFactoryWarmup.wait();
+
 	m_sendingAudio = false;
 
 	if (m_audioThread.joinable())
@@ -545,6 +1850,11 @@ void MediaSoupTransceiver::StopSendTransport()
 		m_dataProducers.clear();
 	}
 
+	if (m_passthroughTap != nullptr)
+		m_passthroughTap->Stop();
+
+	m_passthroughProducer.clear();
+
 	while (SenderConnected())
 		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
@@ -580,10 +1890,19 @@ void MediaSoupTransceiver::TryClose(mediasoupclient::Consumer *dataConsumer)
 	}
 }
 
+// Not while the jitter thread is measuring it
+void MediaSoupTransceiver::DeleteConsumer(mediasoupclient::Consumer *dataConsumer)
+{
+	std::lock_guard<std::mutex> grd(m_jitterMeasureMutex);
+	delete dataConsumer;
+}
+
 void MediaSoupTransceiver::Stop()
 {
 	std::lock_guard<std::recursive_mutex> grd(m_transportMutex);
 
+	StopJitterThread();
+
 	m_sendingAudio = false;
 
 	if (m_audioThread.joinable())
@@ -610,23 +1929,39 @@ void MediaSoupTransceiver::Stop()
 		m_dataProducers.clear();
 	}
 
+	if (m_passthroughTap != nullptr)
+		m_passthroughTap->Stop();
+
+	m_passthroughProducer.clear();
+
 	{
 		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
 
 		for (auto &itr : m_dataConsumers) {
+			if (itr.second.second != nullptr)
+				itr.second.second->stopRecording();
+
 			if (itr.second.first != nullptr)
 				TryClose(itr.second.first);
 
-			delete itr.second.first;
+			DeleteConsumer(itr.second.first);
 		}
 	}
 
 	delete m_recvTransport;
 	delete m_sendTransport;
 
+	// A warm up nobody claimed still has to finish, and its factory be released, before the threads go
+	if (m_producerFactoryWarmup.valid())
+		m_producerFactoryWarmup.get();
+
+	if (m_consumerFactoryWarmup.valid())
+		m_consumerFactoryWarmup.get();
+
 	m_device = nullptr;
 	m_factory_Producer = nullptr;
 	m_factory_Consumer = nullptr;
+	m_MyConsumerAudioDeviceModule = nullptr;
 
 	m_networkThread_Producer = nullptr;
 	m_signalingThread_Producer = nullptr;
@@ -640,6 +1975,7 @@ void MediaSoupTransceiver::Stop()
 		// The sinks are in here too
 		std::lock_guard<std::recursive_mutex> grd(m_consumerMutex);
 		m_dataConsumers.clear();
+		m_decodeScheduler.clear();
 	}
 }
 
@@ -773,6 +2109,11 @@ void MediaSoupTransceiver::StopProducerById(const std::string &id)
 		delete itr->second.first;
 		itr = m_dataProducers.erase(itr);
 	}
+
+	if (!m_passthroughProducer.empty() && m_passthroughProducer == id) {
+		m_passthroughTap->Stop();
+		m_passthroughProducer.clear();
+	}
 }
 
 void MediaSoupTransceiver::StopConsumerById(const std::string &id)
@@ -786,9 +2127,11 @@ void MediaSoupTransceiver::StopConsumerById(const std::string &id)
 		if (itr->second.first != nullptr)
 			TryClose(itr->second.first);
 
-		delete itr->second.first;
+		DeleteConsumer(itr->second.first);
 		itr = m_dataConsumers.erase(itr);
 	}
+
+	m_decodeScheduler.removeConsumer(id);
 }
 
 std::string MediaSoupTransceiver::StopConsumerByProducerId(const std::string &id)
@@ -806,8 +2149,9 @@ std::string MediaSoupTransceiver::StopConsumerByProducerId(const std::string &id
 
 		if (itr->second.first->GetProducerId() == id) {
 			result = itr->second.first->GetId();
+			m_decodeScheduler.removeConsumer(result);
 			TryClose(itr->second.first);
-			delete itr->second.first;
+			DeleteConsumer(itr->second.first);
 			itr = m_dataConsumers.erase(itr);
 		} else {
 			++itr;
@@ -827,6 +2171,7 @@ void MediaSoupTransceiver::OnTransportClose(mediasoupclient::Consumer *consumer)
 
 	while (itr != m_dataConsumers.end()) {
 		if (itr->second.first != nullptr && itr->second.first->GetId() == consumer->GetId()) {
+			m_decodeScheduler.removeConsumer(itr->first);
 			m_dataConsumers.erase(itr);
 			return;
 		} else {
@@ -884,48 +2229,433 @@ bool MediaSoupTransceiver::ConsumerReadyAtLeastOne()
 * Sinks 
 */
 
+// Flushes whatever is queued, so this waits on the disk
+void MediaSoupTransceiver::GenericSink::stopRecording()
+{
+	if (m_recordingSource != nullptr)
+		m_recordingSource->RemoveEncodedSink(static_cast<MediaSoupIvfRecorder *>(m_recorder.get()));
+
+	if (m_opusTap != nullptr)
+		m_opusTap->setRecorder(nullptr);
+
+	if (m_recorder != nullptr)
+		m_recorder->close();
+
+	m_recordingSource = nullptr;
+	m_recorder = nullptr;
+}
+
 void MediaSoupTransceiver::MyVideoSink::OnFrame(const webrtc::VideoFrame &video_frame)
 {
-	// copy
-	m_mailbox->push_received_videoFrame(std::make_unique<webrtc::VideoFrame>(video_frame));
+	markFirstFrame();
+	countDecoded(video_frame);
+
+	if (m_asyncOutput) {
+		outputAsyncFrame(video_frame);
+		return;
+	}
+
+	rtc::scoped_refptr<webrtc::VideoFrameBuffer> source = video_frame.video_frame_buffer();
+
+	// Size of the stream itself, the source reports this regardless of how small we end up drawing it
+	m_mailbox->set_received_videoNativeSize(source->width(), source->height());
+
+	int croppedWidth = 0;
+	int croppedHeight = 0;
+	int outWidth = 0;
+	int outHeight = 0;
+
+	// Frame rate is over what the canvas can show
+	if (!m_adapter.AdaptFrameResolution(source->width(), source->height(), video_frame.timestamp_us() * rtc::kNumNanosecsPerMicrosec, &croppedWidth,
+					    &croppedHeight, &outWidth, &outHeight))
+		return;
+
+	const bool scaled = outWidth != source->width() || outHeight != source->height();
+
+	// Decoded I420 at full size is what the view uploads anyway, the mailbox takes a reference and nothing is copied
+	if (!scaled && source->type() == webrtc::VideoFrameBuffer::Type::kI420) {
+		pushReceivedFrame(video_frame, source);
+		return;
+	}
+
+	rtc::scoped_refptr<webrtc::I420Buffer> scratch = getScratchBuffer(outWidth, outHeight);
+
+	// Mailbox is still holding every buffer, it'll get the next one
+	if (scratch == nullptr)
+		return;
+
+	if (scaled) {
+		// Shown smaller than it's sent, scale down once here instead of uploading pixels the gpu throws away
+		rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = source->ToI420();
+
+		if (i420 == nullptr)
+			return;
+
+		scratch->CropAndScaleFrom(*i420, (i420->width() - croppedWidth) / 2, (i420->height() - croppedHeight) / 2, croppedWidth, croppedHeight);
+	} else if (source->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+		const webrtc::NV12BufferInterface *nv12 = source->GetNV12();
+		libyuv::NV12ToI420(nv12->DataY(), nv12->StrideY(), nv12->DataUV(), nv12->StrideUV(), scratch->MutableDataY(), scratch->StrideY(),
+				   scratch->MutableDataU(), scratch->StrideU(), scratch->MutableDataV(), scratch->StrideV(), scratch->width(), scratch->height());
+	} else {
+		// Anything else (ie, a native hardware buffer) converts through webrtc's own mapping
+		rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = source->ToI420();
+
+		if (i420 == nullptr)
+			return;
+
+		libyuv::I420Copy(i420->DataY(), i420->StrideY(), i420->DataU(), i420->StrideU(), i420->DataV(), i420->StrideV(), scratch->MutableDataY(),
+				 scratch->StrideY(), scratch->MutableDataU(), scratch->StrideU(), scratch->MutableDataV(), scratch->StrideV(), scratch->width(),
+				 scratch->height());
+	}
+
+	pushReceivedFrame(video_frame, scratch);
+}
+
+void MediaSoupTransceiver::MyVideoSink::pushReceivedFrame(const webrtc::VideoFrame &video_frame, rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer)
+{
+	m_mailbox->push_received_videoFrame(webrtc::VideoFrame::Builder()
+						    .set_video_frame_buffer(buffer)
+						    .set_timestamp_rtp(video_frame.timestamp())
+						    .set_timestamp_ms(video_frame.render_time_ms() - m_presentationCutMs)
+						    .set_rotation(video_frame.rotation())
+						    .set_id(video_frame.id())
+						    .build());
+}
+
+void MediaSoupTransceiver::MyVideoSink::countDecoded(const webrtc::VideoFrame &video_frame)
+{
+	const int pixels = video_frame.width() * video_frame.height();
+	m_decodedPixels += uint64_t(pixels);
+
+	if (pixels > m_largestFramePixels)
+		m_largestFramePixels = pixels;
+}
+
+// OBS copies the planes into its own async cache, paces them against its clock and converts on the gpu
+void MediaSoupTransceiver::MyVideoSink::outputAsyncFrame(const webrtc::VideoFrame &video_frame)
+{
+	if (m_obs_source == nullptr)
+		return;
+
+	int croppedWidth = 0;
+	int croppedHeight = 0;
+	int outWidth = 0;
+	int outHeight = 0;
+
+	// Only the framerate is limited for async sources (obs sizes them by the frames they get)
+	if (!m_adapter.AdaptFrameResolution(video_frame.width(), video_frame.height(), video_frame.timestamp_us() * rtc::kNumNanosecsPerMicrosec,
+					    &croppedWidth, &croppedHeight, &outWidth, &outHeight))
+		return;
+
+	rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = video_frame.video_frame_buffer()->ToI420();
+
+	if (i420 == nullptr)
+		return;
+
+	// obs_source_frame has no rotation, so this is the one case still done on the cpu
+	if (video_frame.rotation() != webrtc::kVideoRotation_0) {
+		const bool sideways = video_frame.rotation() == webrtc::kVideoRotation_90 || video_frame.rotation() == webrtc::kVideoRotation_270;
+		rtc::scoped_refptr<webrtc::I420Buffer> scratch =
+			getScratchBuffer(sideways ? i420->height() : i420->width(), sideways ? i420->width() : i420->height());
+
+		if (scratch == nullptr)
+			return;
+
+		libyuv::I420Rotate(i420->DataY(), i420->StrideY(), i420->DataU(), i420->StrideU(), i420->DataV(), i420->StrideV(), scratch->MutableDataY(),
+				   scratch->StrideY(), scratch->MutableDataU(), scratch->StrideU(), scratch->MutableDataV(), scratch->StrideV(), i420->width(),
+				   i420->height(), static_cast<libyuv::RotationMode>(video_frame.rotation()));
+
+		i420 = scratch;
+	}
+
+	obs_source_frame frame = {};
+	frame.format = VIDEO_FORMAT_I420;
+	frame.width = uint32_t(i420->width());
+	frame.height = uint32_t(i420->height());
+	frame.data[0] = const_cast<uint8_t *>(i420->DataY());
+	frame.data[1] = const_cast<uint8_t *>(i420->DataU());
+	frame.data[2] = const_cast<uint8_t *>(i420->DataV());
+	frame.linesize[0] = uint32_t(i420->StrideY());
+	frame.linesize[1] = uint32_t(i420->StrideU());
+	frame.linesize[2] = uint32_t(i420->StrideV());
+
+	// render_time_ms is on webrtc's clock, obs holds the frame until the mapped time comes around
+	frame.timestamp = MediaSoupSyncEngine::instance().getVideoPresentationTime(video_frame.render_time_ms() - m_presentationCutMs);
+
+	video_format_get_parameters(VIDEO_CS_601, VIDEO_RANGE_PARTIAL, frame.color_matrix, frame.color_range_min, frame.color_range_max);
+	obs_source_output_video(m_obs_source, &frame);
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> MediaSoupTransceiver::MyVideoSink::getScratchBuffer(const int width, const int height)
+{
+	// Resolution changed, let whoever still holds the old ones finish with them
+	if (!m_scratch.empty() && (m_scratch.front()->width() != width || m_scratch.front()->height() != height))
+		m_scratch.clear();
+
+	for (auto &itr : m_scratch) {
+		// Only we reference it, so neither the mailbox nor the renderer are using it
+		if (itr->HasOneRef())
+			return itr;
+	}
+
+	if (m_scratch.size() >= kMaxScratchBuffers)
+		return nullptr;
+
+	m_scratch.push_back(new ScratchBuffer(width, height));
+	return m_scratch.back();
+}
+
+MediaSoupTransceiver::MyAudioSink::~MyAudioSink()
+{
+	if (auto mixer = std::atomic_load(&m_mixer))
+		mixer->removeInput(m_consumerId);
 }
 
 void MediaSoupTransceiver::MyAudioSink::OnData(const void *audio_data, int bits_per_sample, int sample_rate, size_t number_of_channels, size_t number_of_frames,
 					       absl::optional<int64_t> absolute_capture_timestamp_ms)
 {
-	size_t number_of_bytes = 0;
+	// Webrtc's sinks are always int16
+	if (bits_per_sample != 16 || number_of_channels == 0 || number_of_channels > MAX_AV_PLANES)
+		return;
 
-	switch (bits_per_sample) {
-	case 8:
-		number_of_bytes = number_of_channels * number_of_frames * sizeof(int8_t);
-		break;
-	case 16:
-		number_of_bytes = number_of_channels * number_of_frames * sizeof(int16_t);
-		break;
-	case 32:
-		number_of_bytes = number_of_channels * number_of_frames * sizeof(int32_t);
-		break;
-	default:
+	const int16_t *samples = static_cast<const int16_t *>(audio_data);
+	markFirstFrame();
+
+	// Measured on what's already decoded, whether it goes to the mixer or to obs
+	updateLevel(samples, number_of_channels * number_of_frames);
+
+	if (auto mixer = std::atomic_load(&m_mixer)) {
+		mixer->push(m_consumerId, samples, sample_rate, number_of_channels, number_of_frames);
 		return;
 	}
 
-	// Output to source
-	obs_source_audio sdata;
-	sdata.data[0] = (uint8_t *)audio_data;
-	sdata.frames = uint32_t(number_of_frames);
-	sdata.speakers = static_cast<speaker_layout>(number_of_channels);
-	sdata.samples_per_sec = sample_rate;
-	sdata.format = MediaSoupTransceiver::GetDefaultAudioFormat();
+	obs_source_t *source = m_obs_source;
 
-	if (absolute_capture_timestamp_ms.has_value())
-		sdata.timestamp = absolute_capture_timestamp_ms.value();
-	else
-		sdata.timestamp = os_gettime_ns();
+	if (source == nullptr)
+		return;
+
+	const struct audio_output_info *obsAudio = audio_output_get_info(obs_get_audio());
+	const uint32_t outputRate = obsAudio != nullptr ? obsAudio->samples_per_sec : uint32_t(sample_rate);
+	const size_t outputChannels = obsAudio != nullptr ? get_audio_channels(obsAudio->speakers) : number_of_channels;
+
+	// Float planar is what obs mixes in, so it doesn't convert on its side
+	m_planes.resize(number_of_channels);
+
+	for (auto &itr : m_planes)
+		itr.resize(number_of_frames);
+
+	deinterleaveToFloat(samples, number_of_channels, number_of_frames, m_planes);
+
+	std::vector<std::vector<float>> *planes = &m_planes;
+	size_t frames = number_of_frames;
+	uint32_t rate = uint32_t(sample_rate);
+
+	// Resampled here in 10 ms blocks, a block of any other length goes through at the source rate
+	if (uint32_t(sample_rate) != outputRate && number_of_frames == size_t(sample_rate / 100)) {
+		if (m_resampleFrom != sample_rate || m_resampleTo != int(outputRate) || m_resamplers.size() != number_of_channels) {
+			m_resamplers.clear();
+
+			for (size_t i = 0; i < number_of_channels; ++i)
+				m_resamplers.push_back(std::make_unique<webrtc::PushSincResampler>(number_of_frames, outputRate / 100));
+
+			m_resampleFrom = sample_rate;
+			m_resampleTo = int(outputRate);
+		}
+
+		frames = outputRate / 100;
+		rate = outputRate;
+		m_resampled.resize(number_of_channels);
+
+		for (size_t i = 0; i < number_of_channels; ++i) {
+			m_resampled[i].resize(frames);
+			m_resamplers[i]->Resample(m_planes[i].data(), number_of_frames, m_resampled[i].data(), frames);
+		}
+
+		planes = &m_resampled;
+	}
+
+	obs_source_audio sdata = {};
+	sdata.frames = uint32_t(frames);
+	sdata.samples_per_sec = rate;
+	sdata.format = AUDIO_FORMAT_FLOAT_PLANAR;
+
+	// Mono into a stereo mix is the same plane twice, otherwise the layout is the stream's own and obs remixes it
+	if (number_of_channels == 1 && outputChannels == 2) {
+		sdata.speakers = SPEAKERS_STEREO;
+		sdata.data[0] = reinterpret_cast<const uint8_t *>((*planes)[0].data());
+		sdata.data[1] = sdata.data[0];
+	} else {
+		sdata.speakers = GetSpeakerLayout(number_of_channels);
+
+		if (sdata.speakers == SPEAKERS_UNKNOWN)
+			return;
+
+		for (size_t i = 0; i < number_of_channels; ++i)
+			sdata.data[i] = reinterpret_cast<const uint8_t *>((*planes)[i].data());
+	}
+
+	// The capture timestamp is on the sender's clock, playout time is what lines up with this participant's video
+	sdata.timestamp = MediaSoupSyncEngine::instance().getAudioPresentationTime(m_clock, frames, rate, m_presentationCutMs);
+	obs_source_output_audio(source, &sdata);
+}
+
+// Fast attack and slow release, so a word lights up right away but short pauses don't drop it
+void MediaSoupTransceiver::MyAudioSink::updateLevel(const int16_t *src, const size_t count)
+{
+	if (count == 0)
+		return;
+
+	uint64_t sumSquares = 0;
+	int peak = 0;
+	measureLevel(src, count, sumSquares, peak);
 
-	obs_source_output_audio(m_obs_source, &sdata);
+	const double meanSquare = double(sumSquares) / double(count);
+	const float dbov = meanSquare > 0.0 ? std::max(-127.f, float(10.0 * std::log10(meanSquare / (32768.0 * 32768.0)))) : -127.f;
 
-	// Workaround to mute webrtc's default playback
-	memset((void *)audio_data, 0, number_of_bytes);
+	float level = m_levelDbov;
+	level += (dbov > level ? 0.5f : 0.05f) * (dbov - level);
+	m_levelDbov = level;
+
+	if (level > MediaSoupTransceiver::getSpeakingOnDbov())
+		m_speaking = true;
+	else if (level < MediaSoupTransceiver::getSpeakingOffDbov())
+		m_speaking = false;
+
+	// The poll resets it with exchange(0) from another thread, a plain compare and store could put back a stale peak over that
+	int previous = m_peak.load();
+
+	while (peak > previous && !m_peak.compare_exchange_weak(previous, peak)) {
+	}
+
+	m_levelUpdatedNs = os_gettime_ns();
+}
+
+// Sum of squares and absolute peak over interleaved int16
+void MediaSoupTransceiver::MyAudioSink::measureLevel(const int16_t *src, const size_t count, uint64_t &sumSquares, int &peak)
+{
+	size_t i = 0;
+	int16_t highest = 0;
+	int16_t lowest = 0;
+	sumSquares = 0;
+
+#if defined(MSOUP_SINK_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vmin = _mm_setzero_si128();
+
+	for (; i + 8 <= count; i += 8) {
+		const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+		// Pairs of squares, at most 2^31 so they're taken as unsigned when widened to 64 bits
+		const __m128i squares = _mm_madd_epi16(samples, samples);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+
+		vmax = _mm_max_epi16(vmax, samples);
+		vmin = _mm_min_epi16(vmin, samples);
+	}
+
+	alignas(16) uint64_t sums[2];
+	alignas(16) int16_t maxes[8];
+	alignas(16) int16_t mins[8];
+	_mm_store_si128(reinterpret_cast<__m128i *>(sums), acc);
+	_mm_store_si128(reinterpret_cast<__m128i *>(maxes), vmax);
+	_mm_store_si128(reinterpret_cast<__m128i *>(mins), vmin);
+	sumSquares = sums[0] + sums[1];
+
+	for (int j = 0; j < 8; ++j) {
+		highest = std::max(highest, maxes[j]);
+		lowest = std::min(lowest, mins[j]);
+	}
+#elif defined(MSOUP_SINK_NEON)
+	int64x2_t acc = vdupq_n_s64(0);
+	int16x8_t vmax = vdupq_n_s16(0);
+	int16x8_t vmin = vdupq_n_s16(0);
+
+	for (; i + 8 <= count; i += 8) {
+		const int16x8_t samples = vld1q_s16(src + i);
+		acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(samples), vget_low_s16(samples)));
+		acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(samples), vget_high_s16(samples)));
+		vmax = vmaxq_s16(vmax, samples);
+		vmin = vminq_s16(vmin, samples);
+	}
+
+	int16_t maxes[8];
+	int16_t mins[8];
+	vst1q_s16(maxes, vmax);
+	vst1q_s16(mins, vmin);
+	sumSquares = uint64_t(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+
+	for (int j = 0; j < 8; ++j) {
+		highest = std::max(highest, maxes[j]);
+		lowest = std::min(lowest, mins[j]);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		sumSquares += uint64_t(int32_t(src[i]) * int32_t(src[i]));
+		highest = std::max(highest, src[i]);
+		lowest = std::min(lowest, src[i]);
+	}
+
+	peak = std::max(int(highest), -int(lowest));
+}
+
+// Interleaved int16 to float planar in [-1, 1)
+void MediaSoupTransceiver::MyAudioSink::deinterleaveToFloat(const int16_t *src, const size_t channels, const size_t frames,
+							    std::vector<std::vector<float>> &output)
+{
+	const float scale = 1.f / 32768.f;
+	size_t i = 0;
+
+#if defined(MSOUP_SINK_SSE2)
+	const __m128 vscale = _mm_set1_ps(scale);
+
+	if (channels == 2) {
+		float *left = output[0].data();
+		float *right = output[1].data();
+
+		// L0 R0 L1 R1 L2 R2 L3 R3, sign extended to two float vectors and then split by lane
+		for (; i + 4 <= frames; i += 4) {
+			const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+			const __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16)), vscale);
+			const __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16)), vscale);
+			_mm_storeu_ps(left + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+	} else if (channels == 1) {
+		float *mono = output[0].data();
+
+		for (; i + 8 <= frames; i += 8) {
+			const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+			_mm_storeu_ps(mono + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16)), vscale));
+			_mm_storeu_ps(mono + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16)), vscale));
+		}
+	}
+#elif defined(MSOUP_SINK_NEON)
+	if (channels == 2) {
+		float *left = output[0].data();
+		float *right = output[1].data();
+
+		// vld2 splits the channels on load
+		for (; i + 4 <= frames; i += 4) {
+			const int16x4x2_t samples = vld2_s16(src + i * 2);
+			vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(samples.val[0])), scale));
+			vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(samples.val[1])), scale));
+		}
+	} else if (channels == 1) {
+		float *mono = output[0].data();
+
+		for (; i + 4 <= frames; i += 4)
+			vst1q_f32(mono + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i))), scale));
+	}
+#endif
+
+	for (; i < frames; ++i) {
+		for (size_t c = 0; c < channels; ++c)
+			output[c][i] = float(src[i * channels + c]) * scale;
+	}
 }
 
 #endif
@@ -2,16 +2,23 @@
 
 #include "Device.hpp"
 #include "Logger.hpp"
+#include "MediaSoupDecodeScheduler.h"
+#include "MediaSoupSyncEngine.h"
+#include "MediaSoupRecorder.h"
 
 #include <obs-module.h>
 
 #include <json.hpp>
 #include <atomic>
+#include <condition_variable>
 #include <media-io/audio-io.h>
 #include <media-io/audio-resampler.h>
 #include <util/platform.h>
 
 #include "api/video/i420_buffer.h"
+#include "rtc_base/ref_counted_object.h"
+#include "media/base/video_adapter.h"
+#include "absl/types/optional.h"
 
 namespace mediasoupclient {
 void Initialize();     // NOLINT(readability-identifier-naming)
@@ -25,6 +32,13 @@ class MediaSoupMailbox;
 class MediaSoupInterface;
 class MediaSoupTransceiver;
 class MyProducerAudioDeviceModule;
+class MyConsumerAudioDeviceModule;
+class MyObsEncoderTap;
+class MediaSoupAudioMixer;
+
+namespace webrtc {
+class PushSincResampler;
+}
 class FrameGeneratorCapturerVideoTrackSource;
 
 /**
@@ -42,20 +56,47 @@ public:
 		ConsumerVideo,
 	};
 
+	enum FirstFrameState {
+		FirstFrameNoConsumer,
+		FirstFrameWaiting,
+		FirstFrameReceived,
+	};
+
 public:
 	MediaSoupTransceiver();
 	~MediaSoupTransceiver();
 
-	bool LoadDevice(json &routerRtpCapabilities, json &output_deviceRtpCapabilities, json &outpudet_viceSctpCapabilities);
+	bool LoadDevice(json &routerRtpCapabilities, json &output_deviceRtpCapabilities, json &outpudet_viceSctpCapabilities, const bool sharedFactory = false);
 	bool CreateReceiver(const std::string &id, const json &iceParameters, const json &iceCandidates, const json &dtlsParameters,
 			    nlohmann::json *sctpParameters = nullptr, nlohmann::json *iceServers = nullptr);
 	bool CreateSender(const std::string &id, const json &iceParameters, const json &iceCandidates, const json &dtlsParameters,
 			  nlohmann::json *iceServers = nullptr);
 	bool CreateAudioConsumer(const std::string &id, const std::string &producerId, json *rtpParameters, obs_source_t *source);
-	bool CreateVideoConsumer(const std::string &id, const std::string &producerId, json *rtpParameters);
+	bool CreateVideoConsumer(const std::string &id, const std::string &producerId, json *rtpParameters, obs_source_t *asyncSource = nullptr);
 	bool CreateVideoProducerTrack(const std::string &id, const nlohmann::json *ebcodings = nullptr, const nlohmann::json *codecOptions = nullptr,
-				      const nlohmann::json *codec = nullptr);
+				      const nlohmann::json *codec = nullptr, const std::string &passthroughEncoder = "", const std::string &contentHint = "");
 	bool CreateAudioProducerTrack(const std::string &id);
+	bool UpdateProducerEncodings(const std::string &id, const nlohmann::json &params, nlohmann::json &output_encodings);
+	bool CanReplaceProducerTrack(const std::string &id);
+	bool ReplaceProducerTrack(const std::string &id, const std::string &contentHint);
+	bool UpdateConsumerSinkWants(const std::string &id, const int maxPixelCount, const int maxFramerate);
+	bool UpdateConsumerDisplay(const std::string &id, const int displayPixels, const int canvasFramerate, const bool visible);
+	void SetDecodeBudget(const int64_t pixelsPerSecond);
+	json GetLayerRequests();
+	bool SetConsumerPaused(const std::string &id, const bool paused);
+	bool SetConsumerAudioSource(const std::string &id, obs_source_t *source);
+	bool SetConsumerAudioMixer(const std::string &id, std::shared_ptr<MediaSoupAudioMixer> mixer);
+	bool ConsumerPaused(const std::string &id);
+	bool SetConsumerJitterBuffer(const std::string &id, const std::string &preset, const int delayMs, const int targetMs);
+	bool SetDefaultJitterBuffer(const std::string &preset, const int delayMs, const int targetMs);
+	json GetJitterBufferState(const std::string &id);
+	void SetJitterPartners(const std::string &videoId, const std::string &audioId);
+	json GetAudioLevels();
+	FirstFrameState RequestFirstKeyFrame(const std::string &id);
+	json GetConsumerStats();
+	bool StartConsumerRecording(const std::string &id, const std::string &path);
+	bool StopConsumerRecording(const std::string &id, json &output);
+	bool ConsumerRecording(const std::string &id);
 
 	bool ProducerReady(const std::string &id);
 	bool ConsumerReady(const std::string &id);
@@ -83,8 +124,11 @@ public:
 	const std::string GetReceiverId();
 	const std::string PopLastError();
 	const std::string &GetId() const { return m_id; }
+	bool SharedFactory() const { return m_sharedFactory; }
+	json GetLoadTimings();
 
 	static audio_format GetDefaultAudioFormat() { return AUDIO_FORMAT_16BIT_PLANAR; }
+	static speaker_layout GetSpeakerLayout(const size_t channels);
 
 public:
 	// SendTransport
@@ -110,16 +154,58 @@ private:
 	void AudioThread(std::shared_ptr<MediaSoupMailbox> mailbox);
 	void TryClose(mediasoupclient::Producer *producer);
 	void TryClose(mediasoupclient::Consumer *dataConsumer);
+	void DeleteConsumer(mediasoupclient::Consumer *dataConsumer);
+	bool StartPassthrough(const std::string &encoderName, json &output_codec);
+	std::string GetDefaultScalabilityMode(const nlohmann::json *codec);
+
+	static webrtc::VideoTrackInterface::ContentHint ToContentHint(const std::string &value);
+	static bool GetJitterPresetDelay(const std::string &preset, const int delayMs, absl::optional<int> &output);
+	bool ApplyJitterBuffer(mediasoupclient::Consumer *consumer, GenericSink &sink, const std::string &preset, const int delayMs, const int targetMs);
+	void StartJitterThread();
+	void StopJitterThread();
+	void JitterThread();
+	void EnforceJitterTargets();
+	void EnforceJitterTarget(const std::string &videoId, const std::string &audioId);
+	bool MeasureConsumerJitterMs(const std::string &id, int &output);
+
+	// Last cumulative jitterBufferDelay/jitterBufferEmittedCount, the average is since then
+	struct JitterBaseline {
+		double m_delaySeconds = 0.0;
+		uint64_t m_emitted = 0;
+		int m_averageMs = 0;
+	};
+
+	static int MeasureJitterBufferMs(const json &stats, JitterBaseline &baseline);
+
+	static int getSmoothJitterBufferDelayMs() { return 300; }
+
+	// Speech starts above the first and ends below the second, a new active speaker has to be this much louder to take over
+	static float getSpeakingOnDbov() { return -40.f; }
+	static float getSpeakingOffDbov() { return -50.f; }
+	static float getActiveSpeakerMarginDb() { return 6.f; }
+	static uint64_t getActiveSpeakerHoldNs() { return 1000000000; }
+
+	// Retried until the first frame shows up, in case the first one went out before the server resumed the consumer
+	static uint64_t getKeyFrameRetryNs() { return 250000000; }
+	static int getDefaultJitterTargetMs() { return 150; }
+	static int getJitterEnforceIntervalMs() { return 500; }
 
 	std::string GetConnectionState(mediasoupclient::Transport *transport);
 
-	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> CreateProducerFactory();
+	void StartFactoryWarmup();
+	bool EnsureProducerFactory();
+	bool EnsureConsumerFactory();
+
+	static int64_t getElapsedMs(const uint64_t startNs) { return int64_t((os_gettime_ns() - startNs) / 1000000); }
+
+	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> CreateProbeFactory(std::unique_ptr<rtc::Thread> &thread);
+	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> CreateProducerFactory(const bool sharedFactory);
 	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> CreateConsumerFactory();
 
 	rtc::scoped_refptr<webrtc::AudioTrackInterface> CreateProducerAudioTrack(rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
 										 const std::string &label);
 	rtc::scoped_refptr<webrtc::VideoTrackInterface> CreateProducerVideoTrack(rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
-										 const std::string &label, std::shared_ptr<MediaSoupMailbox> ptr);
+										 const std::string &label, std::shared_ptr<MediaSoupMailbox> ptr, const bool isScreencast);
 
 	json m_dtlsParameters_local;
 
@@ -131,6 +217,12 @@ private:
 	std::thread m_audioThread;
 	std::atomic<bool> m_sendingAudio{false};
 
+	// Holds "minimal" to its target, GetStats blocks on the signaling thread so it's kept off the graphics one
+	std::thread m_jitterThread;
+	std::mutex m_jitterThreadMutex;
+	std::condition_variable m_jitterThreadCv;
+	bool m_jitterThreadRunning{false};
+
 	std::mutex m_stateMutex;
 	std::recursive_mutex m_transportMutex;
 
@@ -141,35 +233,137 @@ private:
 
 	std::map<mediasoupclient::Transport *, std::string> m_connectionState;
 
+	// Built in the background from LoadDevice, claimed by the first transport that needs one
+	std::future<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>> m_producerFactoryWarmup;
+	std::future<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>> m_consumerFactoryWarmup;
+	bool m_sharedFactory{false};
+
+	// Load phase, in ms and -1 until measured
+	std::atomic<int64_t> m_loadDeviceMs{-1};
+	std::atomic<int64_t> m_probeFactoryMs{-1};
+	std::atomic<int64_t> m_deviceLoadMs{-1};
+	std::atomic<int64_t> m_producerFactoryMs{-1};
+	std::atomic<int64_t> m_consumerFactoryMs{-1};
+	std::atomic<int64_t> m_producerFactoryWaitMs{-1};
+	std::atomic<int64_t> m_consumerFactoryWaitMs{-1};
+
 	// Sinks
 private:
 	class GenericSink {
 	public:
-		virtual ~GenericSink() {}
+		virtual ~GenericSink() { stopRecording(); }
 		ConsumerType m_consumerType;
 		std::shared_ptr<MediaSoupMailbox> m_mailbox;
-		obs_source_t *m_obs_source{nullptr};
+
+		// Can be handed to another source while webrtc is delivering
+		std::atomic<obs_source_t *> m_obs_source{nullptr};
+
+		// Fast start, m_firstFrameNs stays 0 until something is decoded
+		uint64_t m_createdNs = os_gettime_ns();
+		std::atomic<uint64_t> m_firstFrameNs{0};
+		uint64_t m_lastKeyFrameRequestNs = 0;
+		int m_keyFrameRequests = 0;
+
+		void markFirstFrame()
+		{
+			if (m_firstFrameNs == 0)
+				m_firstFrameNs = os_gettime_ns();
+		}
+
+		// Jitter buffer preset, no minimum delay means webrtc's default
+		std::string m_jitterPreset;
+		absl::optional<int> m_jitterMinimumDelayMs;
+		int m_jitterTargetMs = 0;
+
+		// The front end's report and the "minimal" enforcer each average since their own last look
+		JitterBaseline m_reportBaseline;
+		JitterBaseline m_enforceBaseline;
+
+		// The participant's other consumer, set from its source so "minimal" cuts both alike
+		std::string m_jitterPartnerId;
+
+		// Taken off the common presentation delay while "minimal" is over its target, always the same for a participant's audio and video
+		std::atomic<int> m_presentationCutMs{0};
+
+		// Encoded recording, the source is held so the sink can still be removed after the consumer is gone
+		std::shared_ptr<MediaSoupRecorder> m_recorder;
+		rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> m_recordingSource;
+		rtc::scoped_refptr<MediaSoupOpusTap> m_opusTap;
+
+		// Needs webrtc's threads for video, so it's called before they're stopped
+		void stopRecording();
 	};
 
 	class MyAudioSink : public webrtc::AudioTrackSinkInterface, public GenericSink {
 	public:
+		~MyAudioSink();
+
 		void OnData(const void *audio_data, int bits_per_sample, int sample_rate, size_t number_of_channels, size_t number_of_frames,
 			    absl::optional<int64_t> absolute_capture_timestamp_ms) override;
+
+		// When set the audio goes to the mixer instead of our own source
+		std::string m_consumerId;
+		std::shared_ptr<MediaSoupAudioMixer> m_mixer;
+
+		// Smoothed level in dBov, the peak since the last poll (0..32768), and whether it counts as speech
+		std::atomic<float> m_levelDbov{-127.f};
+		std::atomic<int> m_peak{0};
+		std::atomic<bool> m_speaking{false};
+		std::atomic<uint64_t> m_levelUpdatedNs{0};
+
+		static void measureLevel(const int16_t *src, const size_t count, uint64_t &sumSquares, int &peak);
+
+	private:
+		static void deinterleaveToFloat(const int16_t *src, const size_t channels, const size_t frames, std::vector<std::vector<float>> &output);
+		void updateLevel(const int16_t *src, const size_t count);
+
+		// Only touched from webrtc's playout pull
+		std::vector<std::vector<float>> m_planes;
+		std::vector<std::vector<float>> m_resampled;
+		std::vector<std::unique_ptr<webrtc::PushSincResampler>> m_resamplers;
+		int m_resampleFrom = 0;
+		int m_resampleTo = 0;
+		MediaSoupSyncEngine::AudioClock m_clock;
 	};
 
+	// Runs on the decode thread, so the frame is made upload ready here rather than in the OBS render callback
 	class MyVideoSink : public rtc::VideoSinkInterface<webrtc::VideoFrame>, public GenericSink {
 	public:
 		void OnFrame(const webrtc::VideoFrame &video_frame) override;
+
+		// Set for async sources, frames then go straight to obs_source_output_video instead of the mailbox
+		bool m_asyncOutput{false};
+
+		// Remote tracks ignore the pixel and framerate limits in VideoSinkWants, so they're applied here
+		cricket::VideoAdapter m_adapter{2};
+
+		// Sampled by the decode scheduler, counts what was decoded rather than what we kept
+		std::atomic<uint64_t> m_decodedPixels{0};
+		std::atomic<int> m_largestFramePixels{0};
+
+		void countDecoded(const webrtc::VideoFrame &video_frame);
+
+	private:
+		typedef rtc::RefCountedObject<webrtc::I420Buffer> ScratchBuffer;
+
+		void outputAsyncFrame(const webrtc::VideoFrame &video_frame);
+		void pushReceivedFrame(const webrtc::VideoFrame &video_frame, rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+
+		// One in each of the mailbox's three slots, the one being written, and the ones a view is holding until they're due
+		static const size_t kMaxScratchBuffers = 8;
+
+		rtc::scoped_refptr<webrtc::I420Buffer> getScratchBuffer(const int width, const int height);
+		std::vector<rtc::scoped_refptr<ScratchBuffer>> m_scratch;
 	};
 
 	rtc::scoped_refptr<MyProducerAudioDeviceModule> m_MyProducerAudioDeviceModule;
-	rtc::scoped_refptr<webrtc::AudioDeviceModule> m_DefaultDeviceCore;
-	std::unique_ptr<webrtc::TaskQueueFactory> m_DefaultDeviceCore_TaskQueue;
+	rtc::scoped_refptr<MyConsumerAudioDeviceModule> m_MyConsumerAudioDeviceModule;
 
 	// Producer
 private:
 	// MediaStreamTrack holds reference to the threads of the PeerConnectionFactory.
 	// Use plain pointers in order to avoid threads being destructed before tracks.
+	// With a shared factory these threads and m_factory_Producer serve the consumers too, and the consumer ones stay empty
 	std::unique_ptr<rtc::Thread> m_networkThread_Producer{nullptr};
 	std::unique_ptr<rtc::Thread> m_signalingThread_Producer{nullptr};
 	std::unique_ptr<rtc::Thread> m_workerThread_Producer{nullptr};
@@ -177,6 +371,13 @@ private:
 	mediasoupclient::PeerConnection::Options m_producerOptions;
 	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> m_factory_Producer;
 
+	// Encoded passthrough, the producer using it skips webrtc's own h264 encode
+	std::shared_ptr<MyObsEncoderTap> m_passthroughTap;
+	std::string m_passthroughProducer;
+
+	// Requested per encoding while Produce() is running, OnProduce() forwards them to the router
+	std::vector<std::string> m_pendingScalabilityModes;
+
 	// id, Producers
 	std::map<std::string, std::pair<mediasoupclient::Producer *, std::shared_ptr<MediaSoupMailbox>>> m_dataProducers;
 
@@ -192,6 +393,18 @@ private:
 	// id, Consumers
 	std::map<std::string, std::pair<mediasoupclient::Consumer *, std::unique_ptr<GenericSink>>> m_dataConsumers;
 
+	// Guarded by m_consumerMutex along with the consumers it schedules
+	MediaSoupDecodeScheduler m_decodeScheduler;
+
+	// Jitter buffer settings new consumers start with, also under m_consumerMutex
+	std::string m_defaultJitterPreset{"default"};
+	int m_defaultJitterDelayMs = 0;
+	int m_defaultJitterTargetMs = getDefaultJitterTargetMs();
+
+	// Active speaker and when it last changed, also under m_consumerMutex
+	std::string m_activeSpeaker;
+	uint64_t m_activeSpeakerSinceNs = 0;
+
 	// Thread safe assignment
 private:
 	void AssignProducer(const std::string &id, mediasoupclient::Producer *value, std::shared_ptr<MediaSoupMailbox> mailbox);
@@ -199,4 +412,7 @@ private:
 
 	std::recursive_mutex m_consumerMutex;
 	std::recursive_mutex m_producerMutex;
+
+	// Held across a GetStats made without m_consumerMutex, a consumer isn't deleted until it's done, taken after m_consumerMutex
+	std::mutex m_jitterMeasureMutex;
 };
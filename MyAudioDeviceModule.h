@@ -1,88 +1,31 @@
 #pragma once
 
-#include "api/task_queue/default_task_queue_factory.h"
-#include "modules/audio_device/include/audio_device_default.h"
-#include "rtc_base/event.h"
+#include "MyProducerAudioDeviceModule.h"
+#include "MyConsumerAudioDeviceModule.h"
+#include "rtc_base/ref_counted_object.h"
 
-class MyProducerAudioDeviceModule : public webrtc::webrtc_impl::AudioDeviceModuleDefault<webrtc::AudioDeviceModule> {
+// For a factory serving both transports, capture is the producer device and playout is the consumer device's pull
+// One transport callback sees both, webrtc sends what PlayData records and the pull is what hands decoded audio to the track sinks
+class MyAudioDeviceModule : public MyProducerAudioDeviceModule {
 public:
-	MyProducerAudioDeviceModule() : audio_callback_(nullptr), rendering_(false), capturing_(false) {}
+	MyAudioDeviceModule() : playout_(new rtc::RefCountedObject<MyConsumerAudioDeviceModule>{}) {}
 
-	~MyProducerAudioDeviceModule() override
-	{
-		StopPlayout();
-		StopRecording();
-	}
-
-	int32_t Init() override { return 0; }
+	~MyAudioDeviceModule() override { playout_->StopPlayout(); }
 
 	int32_t RegisterAudioCallback(webrtc::AudioTransport *callback) override
 	{
-		webrtc::MutexLock lock(&lock_);
-		RTC_DCHECK(callback || audio_callback_);
-		audio_callback_ = callback;
-		return 0;
-	}
-
-	int32_t StartPlayout() override
-	{
-		webrtc::MutexLock lock(&lock_);
-		rendering_ = true;
-		return 0;
-	}
-
-	int32_t StopPlayout() override
-	{
-		webrtc::MutexLock lock(&lock_);
-		rendering_ = false;
-		return 0;
-	}
-
-	int32_t StartRecording() override
-	{
-		webrtc::MutexLock lock(&lock_);
-		capturing_ = true;
-		return 0;
-	}
-
-	int32_t StopRecording() override
-	{
-		webrtc::MutexLock lock(&lock_);
-		capturing_ = false;
-		return 0;
-	}
-
-	bool Playing() const override
-	{
-		webrtc::MutexLock lock(&lock_);
-		return rendering_;
-	}
-
-	bool Recording() const override
-	{
-		webrtc::MutexLock lock(&lock_);
-		return capturing_;
+		playout_->RegisterAudioCallback(callback);
+		return MyProducerAudioDeviceModule::RegisterAudioCallback(callback);
 	}
 
-public:
-	void PlayData(const void *audioSamples, const size_t nSamples, const size_t nBytesPerSample, const size_t nChannels, const uint32_t samples_per_sec,
-		      const uint32_t total_delay_ms, const int32_t clockDrift, const uint32_t currentMicLevel, const bool keyPressed, uint32_t &newMicLevel)
-	{
-		if (audio_callback_ == nullptr)
-			return;
-
-		audio_callback_->RecordedDataIsAvailable(audioSamples, nSamples, nBytesPerSample, nChannels, samples_per_sec, total_delay_ms, clockDrift,
-							 currentMicLevel, keyPressed, newMicLevel);
-	}
+	int32_t PlayoutIsAvailable(bool *available) override { return playout_->PlayoutIsAvailable(available); }
+	int32_t StereoPlayoutIsAvailable(bool *available) const override { return playout_->StereoPlayoutIsAvailable(available); }
+	int32_t InitPlayout() override { return playout_->InitPlayout(); }
+	bool PlayoutIsInitialized() const override { return playout_->PlayoutIsInitialized(); }
+	int32_t StartPlayout() override { return playout_->StartPlayout(); }
+	int32_t StopPlayout() override { return playout_->StopPlayout(); }
+	bool Playing() const override { return playout_->Playing(); }
 
 private:
-	mutable webrtc::Mutex lock_;
-
-	rtc::Event done_rendering_;
-	rtc::Event done_capturing_;
-
-	bool rendering_ RTC_GUARDED_BY(lock_);
-	bool capturing_ RTC_GUARDED_BY(lock_);
-
-	webrtc::AudioTransport *audio_callback_ RTC_GUARDED_BY(lock_) = nullptr;
+	rtc::scoped_refptr<MyConsumerAudioDeviceModule> playout_;
 };
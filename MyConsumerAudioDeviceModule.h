@@ -0,0 +1,122 @@
+#pragma once
+
+#include "modules/audio_device/include/audio_device_default.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Playout device for the consumer factory that never touches hardware
+// Webrtc only hands decoded audio to the track sinks while something pulls playout data, so this pulls every 10 ms on its own clock and drops the mix
+class MyConsumerAudioDeviceModule : public webrtc::webrtc_impl::AudioDeviceModuleDefault<webrtc::AudioDeviceModule> {
+public:
+	MyConsumerAudioDeviceModule() : audio_callback_(nullptr), rendering_(false) {}
+
+	~MyConsumerAudioDeviceModule() override { StopPlayout(); }
+
+	int32_t Init() override { return 0; }
+
+	int32_t RegisterAudioCallback(webrtc::AudioTransport *callback) override
+	{
+		webrtc::MutexLock lock(&lock_);
+		audio_callback_ = callback;
+		return 0;
+	}
+
+	int32_t PlayoutIsAvailable(bool *available) override
+	{
+		*available = true;
+		return 0;
+	}
+
+	int32_t StereoPlayoutIsAvailable(bool *available) const override
+	{
+		*available = true;
+		return 0;
+	}
+
+	int32_t InitPlayout() override { return 0; }
+	bool PlayoutIsInitialized() const override { return true; }
+
+	int32_t StartPlayout() override
+	{
+		webrtc::MutexLock lock(&lock_);
+
+		if (rendering_)
+			return 0;
+
+		rendering_ = true;
+		stop_ = false;
+		thread_ = std::thread(&MyConsumerAudioDeviceModule::PullThread, this);
+		return 0;
+	}
+
+	int32_t StopPlayout() override
+	{
+		{
+			webrtc::MutexLock lock(&lock_);
+
+			if (!rendering_)
+				return 0;
+
+			rendering_ = false;
+			stop_ = true;
+		}
+
+		if (thread_.joinable())
+			thread_.join();
+
+		return 0;
+	}
+
+	bool Playing() const override
+	{
+		webrtc::MutexLock lock(&lock_);
+		return rendering_;
+	}
+
+	// Opus decodes at this rate, so webrtc doesn't resample just to fill our buffer
+	static const uint32_t kSampleRate = 48000;
+	static const size_t kChannels = 2;
+	static const size_t kFramesPer10Ms = kSampleRate / 100;
+
+private:
+	// Deadlines are absolute so sleep overshoot doesn't accumulate, if we fall far behind we resync instead of bursting
+	void PullThread()
+	{
+		std::vector<int16_t> buffer(kFramesPer10Ms * kChannels);
+		const auto interval = std::chrono::milliseconds(10);
+		auto deadline = std::chrono::steady_clock::now();
+
+		while (!stop_) {
+			{
+				webrtc::MutexLock lock(&lock_);
+
+				if (audio_callback_ != nullptr) {
+					size_t samplesOut = 0;
+					int64_t elapsedTimeMs = 0;
+					int64_t ntpTimeMs = 0;
+					audio_callback_->NeedMorePlayData(kFramesPer10Ms, kChannels * sizeof(int16_t), kChannels, kSampleRate, buffer.data(), samplesOut,
+									  &elapsedTimeMs, &ntpTimeMs);
+				}
+			}
+
+			deadline += interval;
+			const auto now = std::chrono::steady_clock::now();
+
+			if (now - deadline > interval * 5)
+				deadline = now;
+			else
+				std::this_thread::sleep_until(deadline);
+		}
+	}
+
+	mutable webrtc::Mutex lock_;
+
+	std::thread thread_;
+	std::atomic<bool> stop_{false};
+
+	bool rendering_ RTC_GUARDED_BY(lock_);
+	webrtc::AudioTransport *audio_callback_ RTC_GUARDED_BY(lock_) = nullptr;
+};
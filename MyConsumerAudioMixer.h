@@ -0,0 +1,48 @@
+#pragma once
+
+#include "api/audio/audio_mixer.h"
+#include "rtc_base/synchronization/mutex.h"
+
+#include <algorithm>
+#include <vector>
+
+// Webrtc's default mixer resamples and sums every receive stream for a playout nobody hears
+// Pulling each source is what hands its decoded audio to the track sinks, so that's all this does, the mix it returns is silence
+class MyConsumerAudioMixer : public webrtc::AudioMixer {
+public:
+	bool AddSource(Source *audio_source) override
+	{
+		webrtc::MutexLock lock(&lock_);
+
+		if (std::find(sources_.begin(), sources_.end(), audio_source) == sources_.end())
+			sources_.push_back(audio_source);
+
+		return true;
+	}
+
+	void RemoveSource(Source *audio_source) override
+	{
+		webrtc::MutexLock lock(&lock_);
+		sources_.erase(std::remove(sources_.begin(), sources_.end(), audio_source), sources_.end());
+	}
+
+	void Mix(size_t number_of_channels, webrtc::AudioFrame *audio_frame_for_mixing) override
+	{
+		webrtc::MutexLock lock(&lock_);
+
+		// At the source's own rate, so nothing is resampled here either
+		for (auto source : sources_)
+			source->GetAudioFrameWithInfo(source->PreferredSampleRate(), &scratch_);
+
+		audio_frame_for_mixing->UpdateFrame(0, nullptr, kSampleRate / 100, kSampleRate, webrtc::AudioFrame::kNormalSpeech, webrtc::AudioFrame::kVadUnknown,
+						    number_of_channels);
+	}
+
+	// Matches the playout pull, the transport then has nothing to resample
+	static const int kSampleRate = 48000;
+
+private:
+	webrtc::Mutex lock_;
+	std::vector<Source *> sources_ RTC_GUARDED_BY(lock_);
+	webrtc::AudioFrame scratch_ RTC_GUARDED_BY(lock_);
+};
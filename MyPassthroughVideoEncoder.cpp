@@ -0,0 +1,356 @@
+#ifndef _DEBUG
+
+#include "MyPassthroughVideoEncoder.h"
+
+#include "api/video_codecs/builtin_video_encoder_factory.h"
+#include "api/video/encoded_image.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "absl/strings/match.h"
+
+/**
+* MyObsEncoderTap
+*/
+
+MyObsEncoderTap::~MyObsEncoderTap()
+{
+	Stop();
+}
+
+bool MyObsEncoderTap::Start(obs_encoder_t *encoder)
+{
+	Stop();
+
+	if (encoder == nullptr || obs_encoder_get_type(encoder) != OBS_ENCODER_VIDEO) {
+		blog(LOG_ERROR, "MyObsEncoderTap::Start - Not a video encoder");
+		return false;
+	}
+
+	const char *codec = obs_encoder_get_codec(encoder);
+
+	if (codec == nullptr || strcmp(codec, "h264") != 0) {
+		blog(LOG_ERROR, "MyObsEncoderTap::Start - Encoder '%s' is not h264", obs_encoder_get_name(encoder));
+		return false;
+	}
+
+	// Webrtc sends in decode order and has no notion of b-frames
+	obs_data_t *encoderSettings = obs_encoder_get_settings(encoder);
+	long long bframes = obs_data_get_int(encoderSettings, "bf");
+	obs_data_release(encoderSettings);
+
+	if (bframes > 0) {
+		blog(LOG_ERROR, "MyObsEncoderTap::Start - Encoder '%s' uses b-frames, cannot be passed through", obs_encoder_get_name(encoder));
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> grd(m_mtx);
+		m_packets.clear();
+		m_header.clear();
+		m_waitingForKeyframe = true;
+		m_armed = true;
+		m_width = obs_encoder_get_width(encoder);
+		m_height = obs_encoder_get_height(encoder);
+	}
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_int(settings, "tap", static_cast<long long>(reinterpret_cast<intptr_t>(this)));
+	m_output = obs_output_create("mediasoupconnector_passthrough", "mediasoup passthrough", settings, nullptr);
+	obs_data_release(settings);
+
+	if (m_output == nullptr) {
+		blog(LOG_ERROR, "MyObsEncoderTap::Start - obs_output_create failed");
+		return false;
+	}
+
+	obs_output_set_video_encoder(m_output, encoder);
+
+	if (!obs_output_start(m_output)) {
+		blog(LOG_ERROR, "MyObsEncoderTap::Start - obs_output_start failed");
+		obs_output_release(m_output);
+		m_output = nullptr;
+		return false;
+	}
+
+	blog(LOG_INFO, "MyObsEncoderTap::Start - Passing through encoder '%s' %ux%u", obs_encoder_get_name(encoder), m_width, m_height);
+	return true;
+}
+
+void MyObsEncoderTap::Stop()
+{
+	if (m_output == nullptr)
+		return;
+
+	obs_output_stop(m_output);
+	obs_output_release(m_output);
+	m_output = nullptr;
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_packets.clear();
+	m_armed = false;
+}
+
+// Start arms the tap for the producer about to be created, any other h264 encoder made meanwhile is a builtin one
+bool MyObsEncoderTap::Claim()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	if (m_claimed || !m_armed || m_output == nullptr)
+		return false;
+
+	m_claimed = true;
+	m_armed = false;
+	return true;
+}
+
+// Webrtc only destroys the passthrough producer's encoder to make it a new one, so that one gets the tap back
+void MyObsEncoderTap::Unclaim()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	if (m_claimed && m_output != nullptr)
+		m_armed = true;
+
+	m_claimed = false;
+}
+
+// libobs has no way to ask a running encoder for an IDR, so drop deltas until the next keyframe arrives on its own
+// The receiver cannot decode them anyway, and the encoder's keyint bounds how long this takes
+void MyObsEncoderTap::RequestKeyframe()
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	if (m_waitingForKeyframe)
+		return;
+
+	m_waitingForKeyframe = true;
+
+	for (auto itr = m_packets.begin(); itr != m_packets.end();) {
+		if (!(*itr)->keyframe)
+			itr = m_packets.erase(itr);
+		else
+			++itr;
+	}
+}
+
+void MyObsEncoderTap::PopPackets(std::vector<std::unique_ptr<Packet>> &output)
+{
+	std::lock_guard<std::mutex> grd(m_mtx);
+	m_packets.swap(output);
+}
+
+void MyObsEncoderTap::OnPacket(struct encoder_packet *packet)
+{
+	if (packet == nullptr || packet->type != OBS_ENCODER_VIDEO)
+		return;
+
+	std::lock_guard<std::mutex> grd(m_mtx);
+
+	if (m_waitingForKeyframe && !packet->keyframe)
+		return;
+
+	m_waitingForKeyframe = false;
+
+	// Overflow? Nobody is pulling, and if an IDR went with the rest the deltas after it are undecodable
+	if (m_packets.size() > 30) {
+		m_packets.clear();
+
+		if (!packet->keyframe) {
+			m_waitingForKeyframe = true;
+			return;
+		}
+	}
+
+	auto ptr = std::make_unique<Packet>();
+	ptr->keyframe = packet->keyframe;
+	ptr->width = m_width;
+	ptr->height = m_height;
+	ptr->rtpTimestamp = static_cast<uint32_t>(packet->pts * 90000 * packet->timebase_num / packet->timebase_den);
+
+	// SPS/PPS are only in the encoder's extra data, the receiver needs them in front of every IDR
+	if (packet->keyframe) {
+		if (m_header.empty()) {
+			uint8_t *header = nullptr;
+			size_t size = 0;
+
+			if (obs_encoder_get_extra_data(packet->encoder, &header, &size))
+				m_header.assign(header, header + size);
+		}
+
+		ptr->data.reserve(m_header.size() + packet->size);
+		ptr->data.insert(ptr->data.end(), m_header.begin(), m_header.end());
+	}
+
+	ptr->data.insert(ptr->data.end(), packet->data, packet->data + packet->size);
+	m_packets.push_back(std::move(ptr));
+}
+
+const char *MyObsEncoderTap::output_get_name(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return "mediasoup passthrough";
+}
+
+void *MyObsEncoderTap::output_create(obs_data_t *settings, obs_output_t *output)
+{
+	UNUSED_PARAMETER(output);
+	return reinterpret_cast<MyObsEncoderTap *>(static_cast<intptr_t>(obs_data_get_int(settings, "tap")));
+}
+
+void MyObsEncoderTap::output_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+bool MyObsEncoderTap::output_start(void *data)
+{
+	MyObsEncoderTap *tap = static_cast<MyObsEncoderTap *>(data);
+
+	if (tap == nullptr || tap->m_output == nullptr)
+		return false;
+
+	if (!obs_output_can_begin_data_capture(tap->m_output, 0))
+		return false;
+
+	if (!obs_output_initialize_encoders(tap->m_output, 0))
+		return false;
+
+	return obs_output_begin_data_capture(tap->m_output, 0);
+}
+
+void MyObsEncoderTap::output_stop(void *data, uint64_t ts)
+{
+	UNUSED_PARAMETER(ts);
+	MyObsEncoderTap *tap = static_cast<MyObsEncoderTap *>(data);
+
+	if (tap != nullptr && tap->m_output != nullptr)
+		obs_output_end_data_capture(tap->m_output);
+}
+
+void MyObsEncoderTap::output_encoded_packet(void *data, struct encoder_packet *packet)
+{
+	if (MyObsEncoderTap *tap = static_cast<MyObsEncoderTap *>(data))
+		tap->OnPacket(packet);
+}
+
+/**
+* MyPassthroughVideoEncoder
+*/
+
+MyPassthroughVideoEncoder::MyPassthroughVideoEncoder(std::shared_ptr<MyObsEncoderTap> tap) : m_tap(tap) {}
+
+// The claim lasts as long as the encoder, webrtc releases and re-inits the same one whenever it reconfigures
+MyPassthroughVideoEncoder::~MyPassthroughVideoEncoder()
+{
+	Release();
+
+	if (m_tap != nullptr)
+		m_tap->Unclaim();
+}
+
+int32_t MyPassthroughVideoEncoder::InitEncode(const webrtc::VideoCodec *codec_settings, const webrtc::VideoEncoder::Settings &settings)
+{
+	if (codec_settings == nullptr || codec_settings->codecType != webrtc::kVideoCodecH264)
+		return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+
+	if (m_tap == nullptr)
+		return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+
+	m_tap->RequestKeyframe();
+	return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t MyPassthroughVideoEncoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback)
+{
+	m_callback = callback;
+	return WEBRTC_VIDEO_CODEC_OK;
+}
+
+// Followed by InitEncode on a reconfigure, so the tap is kept
+int32_t MyPassthroughVideoEncoder::Release()
+{
+	m_callback = nullptr;
+	return WEBRTC_VIDEO_CODEC_OK;
+}
+
+// The raw frame is only used as a clock, the bitstream comes from obs
+int32_t MyPassthroughVideoEncoder::Encode(const webrtc::VideoFrame &frame, const std::vector<webrtc::VideoFrameType> *frame_types)
+{
+	if (m_callback == nullptr || m_tap == nullptr)
+		return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+
+	if (frame_types != nullptr) {
+		for (auto &type : *frame_types) {
+			if (type == webrtc::VideoFrameType::kVideoFrameKey) {
+				m_tap->RequestKeyframe();
+				break;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<MyObsEncoderTap::Packet>> packets;
+	m_tap->PopPackets(packets);
+
+	for (auto &itr : packets) {
+		webrtc::EncodedImage image;
+		image.SetEncodedData(webrtc::EncodedImageBuffer::Create(itr->data.data(), itr->data.size()));
+		image.SetTimestamp(itr->rtpTimestamp);
+		image._encodedWidth = itr->width;
+		image._encodedHeight = itr->height;
+		image._frameType = itr->keyframe ? webrtc::VideoFrameType::kVideoFrameKey : webrtc::VideoFrameType::kVideoFrameDelta;
+		image.capture_time_ms_ = frame.render_time_ms();
+		image.rotation_ = webrtc::kVideoRotation_0;
+		image.content_type_ = webrtc::VideoContentType::UNSPECIFIED;
+		image.timing_.flags = webrtc::VideoSendTiming::kInvalid;
+
+		webrtc::CodecSpecificInfo info;
+		info.codecType = webrtc::kVideoCodecH264;
+		info.codecSpecific.H264.packetization_mode = webrtc::H264PacketizationMode::NonInterleaved;
+		info.codecSpecific.H264.temporal_idx = webrtc::kNoTemporalIdx;
+		info.codecSpecific.H264.base_layer_sync = false;
+		info.codecSpecific.H264.idr_frame = itr->keyframe;
+
+		m_callback->OnEncodedImage(image, &info);
+	}
+
+	return WEBRTC_VIDEO_CODEC_OK;
+}
+
+// Bitrate belongs to the obs encoder
+void MyPassthroughVideoEncoder::SetRates(const webrtc::VideoEncoder::RateControlParameters &parameters) {}
+
+webrtc::VideoEncoder::EncoderInfo MyPassthroughVideoEncoder::GetEncoderInfo() const
+{
+	webrtc::VideoEncoder::EncoderInfo info;
+	info.implementation_name = "obs_passthrough";
+	info.supports_native_handle = false;
+	info.is_hardware_accelerated = false;
+	info.has_trusted_rate_controller = false;
+	info.scaling_settings = webrtc::VideoEncoder::ScalingSettings::kOff;
+	return info;
+}
+
+/**
+* MyPassthroughVideoEncoderFactory
+*/
+
+MyPassthroughVideoEncoderFactory::MyPassthroughVideoEncoderFactory(std::shared_ptr<MyObsEncoderTap> tap)
+	: m_builtinFactory(webrtc::CreateBuiltinVideoEncoderFactory()), m_tap(tap)
+{
+}
+
+std::vector<webrtc::SdpVideoFormat> MyPassthroughVideoEncoderFactory::GetSupportedFormats() const
+{
+	return m_builtinFactory->GetSupportedFormats();
+}
+
+std::unique_ptr<webrtc::VideoEncoder> MyPassthroughVideoEncoderFactory::CreateVideoEncoder(const webrtc::SdpVideoFormat &format)
+{
+	if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName) && m_tap->Claim())
+		return std::make_unique<MyPassthroughVideoEncoder>(m_tap);
+
+	return m_builtinFactory->CreateVideoEncoder(format);
+}
+
+#endif
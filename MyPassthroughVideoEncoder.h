@@ -0,0 +1,101 @@
+#pragma once
+
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "api/video_codecs/sdp_video_format.h"
+
+#include <obs-module.h>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+/**
+* MyObsEncoderTap
+*/
+
+// Attaches a private encoded output to an OBS encoder (ie, the one already used for streaming) so its packets can be sent as is
+class MyObsEncoderTap {
+public:
+	struct Packet {
+		std::vector<uint8_t> data;
+		uint32_t rtpTimestamp = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		bool keyframe = false;
+	};
+
+public:
+	~MyObsEncoderTap();
+
+	bool Start(obs_encoder_t *encoder);
+	void Stop();
+	bool Active() const { return m_output != nullptr; }
+
+	// Only one webrtc encoder can own the packets at a time, and only the passthrough producer's
+	bool Claim();
+	void Unclaim();
+
+	void RequestKeyframe();
+	void PopPackets(std::vector<std::unique_ptr<Packet>> &output);
+
+public:
+	// obs_output_info
+	static const char *output_get_name(void *unused);
+	static void *output_create(obs_data_t *settings, obs_output_t *output);
+	static void output_destroy(void *data);
+	static bool output_start(void *data);
+	static void output_stop(void *data, uint64_t ts);
+	static void output_encoded_packet(void *data, struct encoder_packet *packet);
+
+private:
+	void OnPacket(struct encoder_packet *packet);
+
+	std::mutex m_mtx;
+	std::vector<std::unique_ptr<Packet>> m_packets;
+	std::vector<uint8_t> m_header;
+
+	obs_output_t *m_output{nullptr};
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	bool m_waitingForKeyframe{true};
+	bool m_claimed{false};
+	bool m_armed{false};
+};
+
+/**
+* MyPassthroughVideoEncoder
+*/
+
+class MyPassthroughVideoEncoder : public webrtc::VideoEncoder {
+public:
+	MyPassthroughVideoEncoder(std::shared_ptr<MyObsEncoderTap> tap);
+	~MyPassthroughVideoEncoder() override;
+
+	int32_t InitEncode(const webrtc::VideoCodec *codec_settings, const webrtc::VideoEncoder::Settings &settings) override;
+	int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback) override;
+	int32_t Release() override;
+	int32_t Encode(const webrtc::VideoFrame &frame, const std::vector<webrtc::VideoFrameType> *frame_types) override;
+	void SetRates(const webrtc::VideoEncoder::RateControlParameters &parameters) override;
+	webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+private:
+	std::shared_ptr<MyObsEncoderTap> m_tap;
+	webrtc::EncodedImageCallback *m_callback{nullptr};
+};
+
+/**
+* MyPassthroughVideoEncoderFactory
+*/
+
+// Hands out the passthrough encoder for the H.264 producer the tap was started for, everything else goes to webrtc's builtin encoders
+class MyPassthroughVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+public:
+	MyPassthroughVideoEncoderFactory(std::shared_ptr<MyObsEncoderTap> tap);
+
+	std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+	std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(const webrtc::SdpVideoFormat &format) override;
+
+private:
+	std::unique_ptr<webrtc::VideoEncoderFactory> m_builtinFactory;
+	std::shared_ptr<MyObsEncoderTap> m_tap;
+};
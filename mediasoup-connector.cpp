@@ -3,6 +3,10 @@
 #include "ConnectorFrontApi.h"
 #include "MyLogSink.h"
 #include "MediaSoupMailbox.h"
+#include "MediaSoupFrameHub.h"
+#include "MyPassthroughVideoEncoder.h"
+#include "MediaSoupGallery.h"
+#include "MediaSoupAudioMixer.h"
 
 #include <third_party/libyuv/include/libyuv.h>
 #include <util/platform.h>
@@ -33,6 +37,8 @@ static const char *msoup_getname(void *unused)
 	return obs_module_text("MediaSoupConnector");
 }
 
+static void msoup_update(void *source, obs_data_t *settings);
+
 // Create
 static void *msoup_create(obs_data_t *settings, obs_source_t *source)
 {
@@ -53,7 +59,25 @@ static void *msoup_create(obs_data_t *settings, obs_source_t *source)
 	proc_handler_add(ph, "void func_stop_sender(in string input, out string output)", ConnectorFrontApi::func_stop_sender, data);
 	proc_handler_add(ph, "void func_stop_consumer(in string input, out string output)", ConnectorFrontApi::func_stop_consumer, data);
 	proc_handler_add(ph, "void func_stop_producer(in string input, out string output)", ConnectorFrontApi::func_stop_producer, data);
-
+	proc_handler_add(ph, "void func_update_producer_encodings(in string input, out string output)", ConnectorFrontApi::func_update_producer_encodings, data);
+	proc_handler_add(ph, "void func_replace_producer_track(in string input, out string output)", ConnectorFrontApi::func_replace_producer_track, data);
+	proc_handler_add(ph, "void func_consumer_state(in string input, out string output)", ConnectorFrontApi::func_consumer_state, data);
+	proc_handler_add(ph, "void func_set_decode_budget(in string input, out string output)", ConnectorFrontApi::func_set_decode_budget, data);
+	proc_handler_add(ph, "void func_get_layer_requests(in string input, out string output)", ConnectorFrontApi::func_get_layer_requests, data);
+	proc_handler_add(ph, "void func_attach_consumer(in string input, out string output)", ConnectorFrontApi::func_attach_consumer, data);
+	proc_handler_add(ph, "void func_set_sync_delay(in string input, out string output)", ConnectorFrontApi::func_set_sync_delay, data);
+	proc_handler_add(ph, "void func_set_jitter_buffer(in string input, out string output)", ConnectorFrontApi::func_set_jitter_buffer, data);
+	proc_handler_add(ph, "void func_get_jitter_buffer(in string input, out string output)", ConnectorFrontApi::func_get_jitter_buffer, data);
+	proc_handler_add(ph, "void func_get_audio_levels(in string input, out string output)", ConnectorFrontApi::func_get_audio_levels, data);
+	proc_handler_add(ph, "void func_get_consumer_stats(in string input, out string output)", ConnectorFrontApi::func_get_consumer_stats, data);
+	proc_handler_add(ph, "void func_get_load_timings(in string input, out string output)", ConnectorFrontApi::func_get_load_timings, data);
+	proc_handler_add(ph, "void func_start_consumer_recording(in string input, out string output)", ConnectorFrontApi::func_start_consumer_recording, data);
+	proc_handler_add(ph, "void func_stop_consumer_recording(in string input, out string output)", ConnectorFrontApi::func_stop_consumer_recording, data);
+
+	// Sent when a consumer is paused or resumed locally, the front end then does the same on the server
+	signal_handler_add(obs_source_get_signal_handler(source), "void consumer_paused(ptr source, string id, string kind, bool paused)");
+
+	msoup_update(data, settings);
 	obs_source_set_audio_active(source, true);
 
 	// Captures webrtc debug msgs
@@ -70,11 +94,9 @@ static void msoup_destroy(void *data)
 	MediaSoupInterface::ObsSourceInfo *sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
 	--MediaSoupInterface::instance().m_sourceCounter;
 
-	if (sourceInfo->m_obs_scene_texture != nullptr)
-		gs_texture_destroy(sourceInfo->m_obs_scene_texture);
-
-	MediaSoupInterface::instance().getTransceiver()->StopConsumerById(sourceInfo->m_consumer_audio);
-	MediaSoupInterface::instance().getTransceiver()->StopConsumerById(sourceInfo->m_consumer_video);
+	// Consumers stop once no other source shows them, the view's textures go with its last reference
+	MediaSoupInterface::instance().detachSource(*sourceInfo);
+	std::atomic_store(&sourceInfo->m_view, std::shared_ptr<MediaSoupInterface::ConsumerView>());
 
 	// We're the last one, final cleanup
 	if (MediaSoupInterface::instance().m_sourceCounter <= 0)
@@ -93,97 +115,68 @@ static void msoup_video_render(void *data, gs_effect_t *e)
 		return;
 
 	//GetConsumerMailbox
-	std::unique_ptr<webrtc::VideoFrame> frame;
 	auto mailbox = MediaSoupInterface::instance().getTransceiver()->GetConsumerMailbox(sourceInfo->m_consumer_video);
 
 	if (mailbox == nullptr)
 		return;
 
-	mailbox->pop_receieved_videoFrames(frame);
-
-	// A new frame arrived, apply it to our cached texture with gs_texture_set_image
-	if (frame != nullptr)
-		MediaSoupInterface::instance().applyVideoFrameToObsTexture(*frame, *sourceInfo);
+	// A new frame arrived, upload its planes to the (possibly shared) view's textures
+	std::shared_ptr<MediaSoupInterface::ConsumerView> view = std::atomic_load(&sourceInfo->m_view);
+	view->refresh(*mailbox);
 
-	if (sourceInfo->m_obs_scene_texture == nullptr)
+	// Pre-created textures hold nothing until the first frame
+	if (!view->m_frame.has_value())
 		return;
 
-	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
-	gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
-	gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
-
-	gs_enable_framebuffer_srgb(false);
-	gs_enable_blending(false);
-	gs_effect_set_texture(image, sourceInfo->m_obs_scene_texture);
-
-	if (gs_technique_begin_pass(tech, 0)) {
-		// Position, center letterbox
-		int xPos = 0;
-		int yPos = 0;
-
-		if (sourceInfo->m_textureWidth < MediaSoupInterface::instance().getHardObsTextureWidth()) {
-			int diff = MediaSoupInterface::instance().getHardObsTextureWidth() - sourceInfo->m_textureWidth;
-			xPos = diff / 2;
-		}
-
-		if (sourceInfo->m_textureHeight < MediaSoupInterface::instance().getHardObsTextureHeight()) {
-			int diff = MediaSoupInterface::instance().getHardObsTextureHeight() - sourceInfo->m_textureHeight;
-			yPos = diff / 2;
-		}
+	view->upload();
 
-		if (xPos != 0 || yPos != 0) {
-			gs_matrix_push();
-			gs_matrix_translate3f(float(xPos), float(yPos), 0.0f);
-		}
-
-		gs_draw_sprite(sourceInfo->m_obs_scene_texture, 0, 0, 0);
-
-		if (xPos != 0 || yPos != 0)
-			gs_matrix_pop();
-
-		gs_technique_end_pass(tech);
-		gs_technique_end(tech);
-	}
-
-	gs_enable_blending(true);
+	// At native size this is a 1:1 draw, otherwise the gpu scales into the configured canvas
+	MediaSoupInterface::drawObsTexture(view->m_texture, MediaSoupInterface::getSourceWidth(*sourceInfo),
+					   MediaSoupInterface::getSourceHeight(*sourceInfo));
 }
 
 static void msoup_video_tick(void *data, float seconds)
 {
-	UNREFERENCED_PARAMETER(data);
-	UNREFERENCED_PARAMETER(seconds);
+	MediaSoupInterface::ObsSourceInfo *sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
+	MediaSoupInterface::updateConsumerSinkWants(*sourceInfo, seconds);
 }
 
 static uint32_t msoup_width(void *data)
 {
-	return uint32_t(MediaSoupInterface::getHardObsTextureWidth());
+	MediaSoupInterface::ObsSourceInfo *sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
+	return uint32_t(MediaSoupInterface::getSourceWidth(*sourceInfo));
 }
 
 static uint32_t msoup_height(void *data)
 {
-	return uint32_t(MediaSoupInterface::getHardObsTextureHeight());
+	MediaSoupInterface::ObsSourceInfo *sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(data);
+	return uint32_t(MediaSoupInterface::getSourceHeight(*sourceInfo));
 }
 
 static obs_properties_t *msoup_properties(void *data)
 {
 	obs_properties_t *ppts = obs_properties_create();
+	obs_properties_add_int(ppts, "canvas_width", obs_module_text("CanvasWidth"), 0, 8192, 1);
+	obs_properties_add_int(ppts, "canvas_height", obs_module_text("CanvasHeight"), 0, 8192, 1);
 	return ppts;
 }
 
 static void msoup_update(void *source, obs_data_t *settings)
 {
-	UNREFERENCED_PARAMETER(source);
-	UNREFERENCED_PARAMETER(settings);
+	MediaSoupInterface::ObsSourceInfo *sourceInfo = static_cast<MediaSoupInterface::ObsSourceInfo *>(source);
+	sourceInfo->m_canvasWidth = int(obs_data_get_int(settings, "canvas_width"));
+	sourceInfo->m_canvasHeight = int(obs_data_get_int(settings, "canvas_height"));
 }
 
+// Activate/deactivate and show/hide all land here, the consumers only pause once the source is neither live nor previewed
 static void msoup_activate(void *data)
 {
-	UNREFERENCED_PARAMETER(data);
+	MediaSoupInterface::updateConsumerPauseState(*static_cast<MediaSoupInterface::ObsSourceInfo *>(data));
 }
 
 static void msoup_deactivate(void *data)
 {
-	UNREFERENCED_PARAMETER(data);
+	MediaSoupInterface::updateConsumerPauseState(*static_cast<MediaSoupInterface::ObsSourceInfo *>(data));
 }
 
 static void msoup_enum_sources(void *data, obs_source_enum_proc_t cb, void *param)
@@ -195,7 +188,120 @@ static void msoup_enum_sources(void *data, obs_source_enum_proc_t cb, void *para
 
 static void msoup_defaults(obs_data_t *settings)
 {
-	UNREFERENCED_PARAMETER(settings);
+	// Native size
+	obs_data_set_default_int(settings, "canvas_width", 0);
+	obs_data_set_default_int(settings, "canvas_height", 0);
+}
+
+/**
+* Gallery
+*/
+
+static const char *msoup_gallery_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("MediaSoupGallery");
+}
+
+static void *msoup_gallery_create(obs_data_t *settings, obs_source_t *source)
+{
+	MediaSoupGallery *gallery = new MediaSoupGallery(source);
+
+	proc_handler_t *ph = obs_source_get_proc_handler(source);
+	proc_handler_add(ph, "void func_gallery_video_consumer_response(in string input, out string output)", ConnectorFrontApi::func_gallery_video_consumer_response,
+			 gallery);
+	proc_handler_add(ph, "void func_gallery_set_producers(in string input, out string output)", ConnectorFrontApi::func_gallery_set_producers, gallery);
+	proc_handler_add(ph, "void func_connect_result(in string input, out string output)", ConnectorFrontApi::func_connect_result, gallery);
+	signal_handler_add(obs_source_get_signal_handler(source), "void consumer_paused(ptr source, string id, string kind, bool paused)");
+
+	gallery->update(settings);
+	++MediaSoupInterface::instance().m_sourceCounter;
+	return gallery;
+}
+
+static void msoup_gallery_destroy(void *data)
+{
+	--MediaSoupInterface::instance().m_sourceCounter;
+	delete static_cast<MediaSoupGallery *>(data);
+
+	if (MediaSoupInterface::instance().m_sourceCounter <= 0)
+		MediaSoupInterface::instance().reset();
+}
+
+static void msoup_gallery_video_render(void *data, gs_effect_t *e)
+{
+	UNREFERENCED_PARAMETER(e);
+	static_cast<MediaSoupGallery *>(data)->render();
+}
+
+static void msoup_gallery_video_tick(void *data, float seconds)
+{
+	static_cast<MediaSoupGallery *>(data)->tick(seconds);
+}
+
+static uint32_t msoup_gallery_width(void *data)
+{
+	return static_cast<MediaSoupGallery *>(data)->getWidth();
+}
+
+static uint32_t msoup_gallery_height(void *data)
+{
+	return static_cast<MediaSoupGallery *>(data)->getHeight();
+}
+
+static void msoup_gallery_update(void *data, obs_data_t *settings)
+{
+	static_cast<MediaSoupGallery *>(data)->update(settings);
+}
+
+static obs_properties_t *msoup_gallery_properties(void *data)
+{
+	obs_properties_t *ppts = obs_properties_create();
+	obs_properties_add_int(ppts, "canvas_width", obs_module_text("CanvasWidth"), 2, 8192, 2);
+	obs_properties_add_int(ppts, "canvas_height", obs_module_text("CanvasHeight"), 2, 8192, 2);
+	return ppts;
+}
+
+static void msoup_gallery_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "canvas_width", 1920);
+	obs_data_set_default_int(settings, "canvas_height", 1080);
+}
+
+/**
+* Mixer
+*/
+
+static const char *msoup_mixer_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("MediaSoupMixer");
+}
+
+static void *msoup_mixer_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+
+	// Shared with the audio sinks it's assigned to
+	auto data = new std::shared_ptr<MediaSoupAudioMixer>(std::make_shared<MediaSoupAudioMixer>(source));
+
+	proc_handler_t *ph = obs_source_get_proc_handler(source);
+	proc_handler_add(ph, "void func_mixer_set_consumers(in string input, out string output)", ConnectorFrontApi::func_mixer_set_consumers, data);
+
+	obs_source_set_audio_active(source, true);
+	return data;
+}
+
+static void msoup_mixer_destroy(void *data)
+{
+	auto mixer = static_cast<std::shared_ptr<MediaSoupAudioMixer> *>(data);
+
+	// Hand the consumers back to their own sources
+	for (auto &id : (*mixer)->getInputIds())
+		MediaSoupInterface::instance().getTransceiver()->SetConsumerAudioMixer(id, nullptr);
+
+	(*mixer)->shutdown();
+	delete mixer;
 }
 
 /**
@@ -278,81 +384,47 @@ static const char *msoup_fvideo_get_name(void *unused)
 // Create
 static void *msoup_fvideo_create(obs_data_t *settings, obs_source_t *source)
 {
-	return settings;
+	return source;
 }
 
 // Destroy
 static void msoup_fvideo_destroy(void *data) {}
 
+// Remove filter
+static void msoup_fvideo_filter_remove(void *data, obs_source_t *parent)
+{
+	auto settings = obs_source_get_settings(static_cast<obs_source_t *>(data));
+	MediaSoupFrameHub::instance().unsubscribe(parent, obs_data_get_string(settings, "producerId"));
+	obs_data_release(settings);
+}
+
 static obs_properties_t *msoup_fvideo_properties(void *data)
 {
 	obs_properties_t *props = obs_properties_create();
 	return props;
 }
 
-static struct obs_source_frame *msoup_fvideo_filter_video(void *data, struct obs_source_frame *frame)
+// Shared by the async and sync filters, conversion happens once per parent source no matter how many producers it feeds
+static void msoup_fvideo_publish_frame(obs_source_t *filter, struct obs_source_frame *frame)
 {
-	std::string producerId = obs_data_get_string(static_cast<obs_data_t *>(data), "producerId");
+	auto settings = obs_source_get_settings(filter);
+	std::string producerId = obs_data_get_string(settings, "producerId");
+	obs_data_release(settings);
 
-	if (!MediaSoupInterface::instance().getTransceiver()->ProducerReady(producerId))
-		return frame;
+	obs_source_t *parent = obs_filter_get_parent(filter);
 
-	auto mailbox = MediaSoupInterface::instance().getTransceiver()->GetProducerMailbox(producerId);
+	if (parent == nullptr)
+		return;
 
-	if (mailbox == nullptr)
-		return frame;
-
-	rtc::scoped_refptr<webrtc::I420Buffer> dest = mailbox->getProducerFrameBuffer(frame->width, frame->height);
-
-	switch (frame->format) {
-	//VIDEO_FORMAT_Y800
-	//VIDEO_FORMAT_I40A
-	//VIDEO_FORMAT_I42A
-	//VIDEO_FORMAT_AYUV
-	//VIDEO_FORMAT_YVYU
-	case VIDEO_FORMAT_YUY2:
-		libyuv::YUY2ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(),
-				   dest->StrideU(), dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_UYVY:
-		libyuv::UYVYToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(),
-				   dest->StrideU(), dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_RGBA:
-		libyuv::RGBAToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(),
-				   dest->StrideU(), dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_BGRA:
-		libyuv::ARGBToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(),
-				   dest->StrideU(), dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_I422:
-		libyuv::I422ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]), frame->data[2],
-				   static_cast<int>(frame->linesize[2]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(), dest->StrideU(),
-				   dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_I444:
-		libyuv::I444ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]), frame->data[2],
-				   static_cast<int>(frame->linesize[2]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(), dest->StrideU(),
-				   dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_NV12:
-		libyuv::NV12ToI420(frame->data[0], static_cast<int>(frame->linesize[0]), frame->data[1], static_cast<int>(frame->linesize[1]),
-				   dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(), dest->StrideU(), dest->MutableDataV(), dest->StrideV(),
-				   dest->width(), dest->height());
-		break;
-	case VIDEO_FORMAT_BGRX:
-		libyuv::ARGBToI420(frame->data[0], static_cast<int>(frame->linesize[0]), dest->MutableDataY(), dest->StrideY(), dest->MutableDataU(),
-				   dest->StrideU(), dest->MutableDataV(), dest->StrideV(), dest->width(), dest->height());
-		break;
-	default:
-		return frame;
-	}
+	if (!MediaSoupInterface::instance().getTransceiver()->ProducerReady(producerId))
+		return;
 
-	if (frame->flip)
-		dest = webrtc::I420Buffer::Rotate(*dest, webrtc::VideoRotation::kVideoRotation_180);
+	MediaSoupFrameHub::instance().publish(parent, producerId, frame);
+}
 
-	mailbox->push_outgoing_videoFrame(dest);
+static struct obs_source_frame *msoup_fvideo_filter_video(void *data, struct obs_source_frame *frame)
+{
+	msoup_fvideo_publish_frame(static_cast<obs_source_t *>(data), frame);
 	return frame;
 }
 
@@ -420,8 +492,10 @@ static void msoup_fsvideo_filter_remove(void *data, obs_source_t *source)
 {
 	mediasoup_sync_filter *vars = static_cast<mediasoup_sync_filter *>(data);
 
-	if (vars)
+	if (vars) {
 		obs_remove_main_render_callback(msoup_fsvideo_filter_offscreen_render, vars);
+		msoup_fvideo_filter_remove(vars->source, source);
+	}
 }
 
 static obs_properties_t *msoup_fsvideo_properties(void *data)
@@ -489,7 +563,8 @@ static void msoup_fsvideo_filter_offscreen_render(void *param, uint32_t cx, uint
 		sframe.height = vars->height;
 		sframe.flip = false;
 		sframe.format = VIDEO_FORMAT_BGRA;
-		msoup_fvideo_filter_video(obs_source_get_settings(vars->source), &sframe);
+		sframe.timestamp = obs_get_video_frame_time();
+		msoup_fvideo_publish_frame(vars->source, &sframe);
 
 		// Release pointer to data from gs
 		gs_stagesurface_unmap(vars->stagesurface);
@@ -539,6 +614,8 @@ bool obs_module_load(void)
 	mediasoup_connector.activate = msoup_activate;
 
 	mediasoup_connector.deactivate = msoup_deactivate;
+	mediasoup_connector.show = msoup_activate;
+	mediasoup_connector.hide = msoup_deactivate;
 	mediasoup_connector.enum_active_sources = msoup_enum_sources;
 
 	mediasoup_connector.get_width = msoup_width;
@@ -548,6 +625,47 @@ bool obs_module_load(void)
 
 	obs_register_source(&mediasoup_connector);
 
+	// Same as above but obs owns the video, frames are pushed from the decode thread with obs_source_output_video
+	struct obs_source_info mediasoup_connector_async = mediasoup_connector;
+	mediasoup_connector_async.id = "mediasoupconnector_async";
+	mediasoup_connector_async.output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_AUDIO | OBS_SOURCE_DO_NOT_DUPLICATE | OBS_SOURCE_DO_NOT_SELF_MONITOR;
+	mediasoup_connector_async.video_render = nullptr;
+	mediasoup_connector_async.get_width = nullptr;
+	mediasoup_connector_async.get_height = nullptr;
+
+	obs_register_source(&mediasoup_connector_async);
+
+	// Gallery, several video consumers drawn from one texture
+	struct obs_source_info mediasoup_gallery = {};
+	mediasoup_gallery.id = "mediasoupconnector_gallery";
+	mediasoup_gallery.type = OBS_SOURCE_TYPE_INPUT;
+	mediasoup_gallery.icon_type = OBS_ICON_TYPE_SLIDESHOW;
+	mediasoup_gallery.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW | OBS_SOURCE_DO_NOT_DUPLICATE;
+	mediasoup_gallery.get_name = msoup_gallery_getname;
+	mediasoup_gallery.create = msoup_gallery_create;
+	mediasoup_gallery.destroy = msoup_gallery_destroy;
+	mediasoup_gallery.update = msoup_gallery_update;
+	mediasoup_gallery.video_render = msoup_gallery_video_render;
+	mediasoup_gallery.video_tick = msoup_gallery_video_tick;
+	mediasoup_gallery.get_width = msoup_gallery_width;
+	mediasoup_gallery.get_height = msoup_gallery_height;
+	mediasoup_gallery.get_defaults = msoup_gallery_defaults;
+	mediasoup_gallery.get_properties = msoup_gallery_properties;
+
+	obs_register_source(&mediasoup_gallery);
+
+	// Mixer, several audio consumers mixed in the plugin and output as one source
+	struct obs_source_info mediasoup_mixer = {};
+	mediasoup_mixer.id = "mediasoupconnector_mixer";
+	mediasoup_mixer.type = OBS_SOURCE_TYPE_INPUT;
+	mediasoup_mixer.icon_type = OBS_ICON_TYPE_AUDIO_OUTPUT;
+	mediasoup_mixer.output_flags = OBS_SOURCE_AUDIO | OBS_SOURCE_DO_NOT_DUPLICATE | OBS_SOURCE_DO_NOT_SELF_MONITOR;
+	mediasoup_mixer.get_name = msoup_mixer_getname;
+	mediasoup_mixer.create = msoup_mixer_create;
+	mediasoup_mixer.destroy = msoup_mixer_destroy;
+
+	obs_register_source(&mediasoup_mixer);
+
 	// Filter (Audio)
 	struct obs_source_info mediasoup_filter_audio = {};
 	mediasoup_filter_audio.id = "mediasoupconnector_afilter";
@@ -575,6 +693,7 @@ bool obs_module_load(void)
 	mediasoup_filter_video.get_defaults = msoup_fvideo_defaults;
 	mediasoup_filter_video.get_properties = msoup_fvideo_properties;
 	mediasoup_filter_video.filter_video = msoup_fvideo_filter_video;
+	mediasoup_filter_video.filter_remove = msoup_fvideo_filter_remove;
 
 	obs_register_source(&mediasoup_filter_video);
 
@@ -594,7 +713,26 @@ bool obs_module_load(void)
 	mediasoup_filter_video_s.filter_remove = msoup_fsvideo_filter_remove;
 
 	obs_register_source(&mediasoup_filter_video_s);
+
+	// Output (Encoder passthrough)
+	struct obs_output_info mediasoup_passthrough = {};
+	mediasoup_passthrough.id = "mediasoupconnector_passthrough";
+	mediasoup_passthrough.flags = OBS_OUTPUT_VIDEO | OBS_OUTPUT_ENCODED;
+	mediasoup_passthrough.encoded_video_codecs = "h264";
+	mediasoup_passthrough.get_name = MyObsEncoderTap::output_get_name;
+	mediasoup_passthrough.create = MyObsEncoderTap::output_create;
+	mediasoup_passthrough.destroy = MyObsEncoderTap::output_destroy;
+	mediasoup_passthrough.start = MyObsEncoderTap::output_start;
+	mediasoup_passthrough.stop = MyObsEncoderTap::output_stop;
+	mediasoup_passthrough.encoded_packet = MyObsEncoderTap::output_encoded_packet;
+
+	obs_register_output(&mediasoup_passthrough);
 	return true;
 }
 
+void obs_module_unload(void)
+{
+	MediaSoupInterface::destroyGraphics();
+}
+
 #endif